@@ -0,0 +1,238 @@
+// Benchmarks of the inversion and filling kernels on synthetic flows.
+//
+// Every kernel runs at 480p, 1080p, 4K and 8K on five kinds of motion. Items
+// processed are pixels, and bytes processed count the arrays read and written by
+// the kernel, so Google Benchmark reports pixels/s and B/s.
+//
+//   ./inverse_optical_flow_benchmark --benchmark_filter='max_method/.*/1080p'
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "inverse_optical_flow.h"
+#include "backward_flow.h"
+
+
+struct resolution {
+    const char *name;
+    int nx, ny;
+};
+
+static const resolution resolutions[] = {
+    {"480p", 854, 480},
+    {"1080p", 1920, 1080},
+    {"4K", 3840, 2160},
+    {"8K", 7680, 4320},
+};
+
+static const char *motions[] = {"translation", "zoom", "rotation", "random", "large_displacement"};
+
+
+/**
+ * Synthetic planar flow (u, v) of the given kind of motion.
+ */
+static void synthetic_flow(const std::string &motion, int nx, int ny, std::vector<float> &u, std::vector<float> &v) {
+    u.resize(nx * ny);
+    v.resize(nx * ny);
+    const float cx = 0.5f * float(nx - 1);
+    const float cy = 0.5f * float(ny - 1);
+    std::mt19937 generator(nx);
+    std::uniform_real_distribution<float> random_motion(-4.f, 4.f);
+    const float angle = 2.f * float(M_PI) / 180.f;
+
+    for (int y = 0; y < ny; y++) {
+        for (int x = 0; x < nx; x++) {
+            const int p = y * nx + x;
+            if (motion == "translation") {
+                u[p] = 3.5f;
+                v[p] = -2.25f;
+            } else if (motion == "zoom") {
+                u[p] = 0.05f * (float(x) - cx);
+                v[p] = 0.05f * (float(y) - cy);
+            } else if (motion == "rotation") {
+                u[p] = std::cos(angle) * (float(x) - cx) - std::sin(angle) * (float(y) - cy) + cx - float(x);
+                v[p] = std::sin(angle) * (float(x) - cx) + std::cos(angle) * (float(y) - cy) + cy - float(y);
+            } else if (motion == "random") {
+                u[p] = random_motion(generator);
+                v[p] = random_motion(generator);
+            } else {
+                // an object of a quarter of the frame moving fast over a slow background
+                const bool object = std::abs(float(x) - cx) < 0.125f * float(nx) && std::abs(float(y) - cy) < 0.125f * float(ny);
+                u[p] = object ? 0.1f * float(nx) : 2.f;
+                v[p] = object ? 0.05f * float(ny) : 1.f;
+            }
+        }
+    }
+}
+
+
+/**
+ * Synthetic interleaved RGB images; the second one is the first one moved by the flow.
+ */
+static void synthetic_images(
+    int nx, int ny, const std::vector<float> &u, const std::vector<float> &v, std::vector<float> I[2]
+) {
+    I[0].resize(3 * nx * ny);
+    I[1].resize(3 * nx * ny);
+    for (int y = 0; y < ny; y++) {
+        for (int x = 0; x < nx; x++) {
+            const int p = y * nx + x;
+            for (int c = 0; c < 3; c++) {
+                const float xs = float(x) - u[p];
+                const float ys = float(y) - v[p];
+                I[0][3 * p + c] = 127.5f + 127.5f * std::sin(0.05f * float(c + 1) * float(x) + 0.03f * float(y));
+                I[1][3 * p + c] = 127.5f + 127.5f * std::sin(0.05f * float(c + 1) * xs + 0.03f * ys);
+            }
+        }
+    }
+}
+
+
+static void set_counters(benchmark::State &state, int64_t pixels, int64_t bytes_per_pixel) {
+    state.SetItemsProcessed(state.iterations() * pixels);
+    state.SetBytesProcessed(state.iterations() * pixels * bytes_per_pixel);
+}
+
+
+// max_method and avg_method of the Python module: flow in, inverse flow and mask out
+static void benchmark_module(benchmark::State &state, const resolution r, const std::string motion, bool average) {
+    std::vector<float> u, v;
+    synthetic_flow(motion, r.nx, r.ny, u, v);
+    const std::ptrdiff_t size = std::ptrdiff_t(r.nx) * r.ny;
+    std::vector<float> flow(u);
+    flow.insert(flow.end(), v.begin(), v.end());
+    const flow_view view = {flow.data(), r.ny, r.nx, size, r.nx, 1};
+    const target_grid grid(r.ny, r.nx);
+    std::vector<float> flow_i(2 * size);
+    std::vector<uint8_t> mask(size);
+
+    for (auto _ : state) {
+        std::fill(flow_i.begin(), flow_i.end(), 0.f);
+        std::fill(mask.begin(), mask.end(), 1);
+        if (average)
+            avg_inverse(view, grid, flow_i.data(), mask.data());
+        else
+            max_inverse(view, grid, flow_i.data(), mask.data());
+        benchmark::DoNotOptimize(flow_i.data());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, size, 2 * sizeof(float) + 2 * sizeof(float) + sizeof(uint8_t));
+}
+
+
+// the four strategies of backward_flow.h, without filling
+static void benchmark_strategy(benchmark::State &state, const resolution r, const std::string motion, int strategy) {
+    std::vector<float> u, v, I[2];
+    synthetic_flow(motion, r.nx, r.ny, u, v);
+    synthetic_images(r.nx, r.ny, u, v, I);
+    const int size = r.nx * r.ny;
+    std::vector<float> u_(size), v_(size), mask(size);
+
+    for (auto _ : state) {
+        backward_flow(I[0].data(), I[1].data(), 3,
+                      u.data(), v.data(), u_.data(), v_.data(), mask.data(), r.nx, r.ny, strategy, 0);
+        benchmark::DoNotOptimize(u_.data());
+        benchmark::ClobberMemory();
+    }
+    const bool image = strategy == MAX_IMAGE_METHOD || strategy == AVG_IMAGE_METHOD;
+    set_counters(state, size, (image ? 8 : 2) * sizeof(float) + 3 * sizeof(float));
+}
+
+
+// the fills of fill_disocclusions.h, through the CLI dispatch, and the region minfill (fill 0), on the holes left by
+// the average strategy
+static void benchmark_fill(benchmark::State &state, const resolution r, const std::string motion, int fill) {
+    std::vector<float> u, v, I[2];
+    synthetic_flow(motion, r.nx, r.ny, u, v);
+    synthetic_images(r.nx, r.ny, u, v, I);
+    const int size = r.nx * r.ny;
+    std::vector<float> u0(size), v0(size), mask0(size);
+    backward_flow(I[0].data(), I[1].data(), 3,
+                  u.data(), v.data(), u0.data(), v0.data(), mask0.data(), r.nx, r.ny, AVG_FLOW_METHOD, 0);
+    std::vector<float> u_(size), v_(size), mask(size);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        u_ = u0;
+        v_ = v0;
+        mask = mask0;
+        state.ResumeTiming();
+        if (fill == 0)
+            minfill(u_.data(), v_.data(), mask.data(), r.nx, r.ny);
+        else
+            fill_backward_flow(u.data(), v.data(), u_.data(), v_.data(), mask.data(), r.nx, r.ny, AVG_FLOW_METHOD, fill);
+        benchmark::DoNotOptimize(u_.data());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, size, 5 * sizeof(float));
+}
+
+
+// labelling of the holes left by the average strategy, as done by the region fills
+static void benchmark_labeling(benchmark::State &state, const resolution r, const std::string motion) {
+    std::vector<float> u, v, I[2];
+    synthetic_flow(motion, r.nx, r.ny, u, v);
+    synthetic_images(r.nx, r.ny, u, v, I);
+    const int size = r.nx * r.ny;
+    std::vector<float> u_(size), v_(size), mask(size);
+    backward_flow(I[0].data(), I[1].data(), 3,
+                  u.data(), v.data(), u_.data(), v_.data(), mask.data(), r.nx, r.ny, AVG_FLOW_METHOD, 0);
+    std::vector<int> regions(size);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(connected_component_labeling(mask.data(), regions.data(), r.nx, r.ny));
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, size, sizeof(float) + sizeof(int));
+}
+
+
+int main(int argc, char **argv) {
+    static const struct { const char *name; int strategy; } strategies[] = {
+        {"MAX_FLOW_METHOD", MAX_FLOW_METHOD},
+        {"MAX_IMAGE_METHOD", MAX_IMAGE_METHOD},
+        {"AVG_FLOW_METHOD", AVG_FLOW_METHOD},
+        {"AVG_IMAGE_METHOD", AVG_IMAGE_METHOD},
+    };
+    static const struct { const char *name; int fill; } fills[] = {
+        {"minfill", 0},
+        {"MIN_FILL", MIN_FILL},
+        {"AVERAGE_FILL", AVERAGE_FILL},
+        {"ORIENTED_FILL", ORIENTED_FILL},
+        {"NEAREST_FILL", NEAREST_FILL},
+        {"PUSH_PULL_FILL", PUSH_PULL_FILL},
+        {"HARMONIC_FILL", HARMONIC_FILL},
+        {"BOUNDED_FILL", BOUNDED_FILL},
+    };
+
+    for (const auto &r : resolutions) {
+        for (const std::string motion : motions) {
+            const std::string suffix = "/" + motion + "/" + r.name;
+            benchmark::RegisterBenchmark(("max_method" + suffix).c_str(), benchmark_module, r, motion, false)
+                ->Unit(benchmark::kMillisecond);
+            benchmark::RegisterBenchmark(("avg_method" + suffix).c_str(), benchmark_module, r, motion, true)
+                ->Unit(benchmark::kMillisecond);
+            for (const auto &s : strategies)
+                benchmark::RegisterBenchmark((s.name + suffix).c_str(), benchmark_strategy, r, motion, s.strategy)
+                    ->Unit(benchmark::kMillisecond);
+            for (const auto &f : fills)
+                benchmark::RegisterBenchmark((f.name + suffix).c_str(), benchmark_fill, r, motion, f.fill)
+                    ->Unit(benchmark::kMillisecond);
+            benchmark::RegisterBenchmark(("connected_component_labeling" + suffix).c_str(), benchmark_labeling, r,
+                                         motion)
+                ->Unit(benchmark::kMillisecond);
+        }
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -1,97 +1,723 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
 #include <ctime>
+#include <algorithm>
+#include <memory>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
 #include "backward_flow.h"
+#include "../src/flow_io.h"
+#include "../src/flow_sequence.h"
 
 extern "C" {
 #include "iio.h"
 }
 
-bool read_image(const char *fname, float **Ir, float **Ig, float **Ib, int &nx, int &ny, int &nz)
+//float buffer aligned to a cache line, only reallocated when it has to grow
+struct float_buffer
+{
+	float *data;
+	int    capacity;
+
+	float_buffer(): data(NULL), capacity(0) {}
+	~float_buffer() { free(data); }
+
+	float *resize(int size)
+	{
+		if(size > capacity)
+		{
+			free(data);
+			if(posix_memalign((void **) &data, 64, size * sizeof(float)) != 0)
+			{
+				data = NULL;
+				capacity = 0;
+				return NULL;
+			}
+			capacity = size;
+		}
+		return data;
+	}
+
+private:
+	float_buffer(const float_buffer &);
+	float_buffer &operator=(const float_buffer &);
+};
+
+
+//interleaved image as decoded by iio, released when the next one is read
+struct image_buffer
+{
+	float *data;
+	int    nx, ny, nz;
+
+	image_buffer(): data(NULL), nx(0), ny(0), nz(0) {}
+	~image_buffer() { free(data); }
+
+private:
+	image_buffer(const image_buffer &);
+	image_buffer &operator=(const image_buffer &);
+};
+
+
+//planar flow components, reused from one frame to the next
+struct flow_buffer
 {
+	float_buffer u, v;
+	int          nx, ny;
 	
-	float *f;
+	//last flow sequence read, kept open to decode its next frames incrementally
+	flow_sequence_reader *sequence;
+	string                sequence_path;
+
+	flow_buffer(): nx(0), ny(0), sequence(NULL) {}
+	~flow_buffer() { delete sequence; }
+};
+
+
+//read the whole standard input, which the "-" input names
+bool read_stdin(vector<uint8_t> &bytes)
+{
+	uint8_t chunk[1 << 16];
+	size_t n;
 	
-	*Ir = *Ig = *Ib = NULL;
+	bytes.clear();
+	while((n = fread(chunk, 1, sizeof(chunk), stdin)) > 0)
+		bytes.insert(bytes.end(), chunk, chunk + n);
 	
-	f = iio_read_image_float_vec(fname, &nx, &ny, &nz);
+	return !ferror(stdin) && !bytes.empty();
+}
+
+
+//read an image, from memory when it comes from the standard input
+bool read_image(const char *fname, image_buffer &I)
+{
+	free(I.data);
+	I.data = NULL;
 	
-	if(nz > 0)
+	if(strcmp(fname, "-") == 0)
 	{
-	    *Ir = new float[nx * ny];
-	    *Ig = new float[nx * ny];
-	    *Ib = new float[nx * ny];
-	    
-	    int dg=1, db=2;
-	    
-	    if(nz == 1) dg=db=0;
-	    
-	    for(int i = 0; i < ny; i++)
-		for(int j = 0; j < nx; j++)
-		{
-		      (*Ir)[i*nx+j] = f[(i*nx+j)*nz];
-		      (*Ig)[i*nx+j] = f[(i*nx+j)*nz+dg];
-		      (*Ib)[i*nx+j] = f[(i*nx+j)*nz+db];
-		}
+		vector<uint8_t> bytes;
+		if(read_stdin(bytes))
+			I.data = iio_read_image_float_vec_m(bytes.data(), bytes.size(), &I.nx, &I.ny, &I.nz);
 	}
+	else
+		I.data = iio_read_image_float_vec(fname, &I.nx, &I.ny, &I.nz);
 	
-	return *Ir ? true : false;
+	return I.data ? true : false;
 }
 
 
-bool read_flow(const char *fname, float **u, float **v, int &nx, int &ny)
+//whether the file starts like a .flo, PFM or .npy flow
+bool is_flow_file(const char *fname)
 {
+	uint8_t magic[8];
+	size_t n = 0;
 	
-	float *f;
-	int nz;
+	if(strcmp(fname, "-") == 0) return false;
 	
-	*u = *v = NULL;
+	FILE *f = fopen(fname, "rb");
+	if(f)
+	{
+		n = fread(magic, 1, sizeof(magic), f);
+		fclose(f);
+	}
+	
+	return is_flow(magic, n);
+}
+
+
+//split "sequence.fseq:frame" into the path of the sequence and the frame index
+bool is_sequence_frame(const char *fname, string &path, int &frame)
+{
+	const char *colon = strrchr(fname, ':');
+	
+	if(!colon || !colon[1] || strspn(colon + 1, "0123456789") != strlen(colon + 1))
+		return false;
+	
+	path.assign(fname, colon);
+	frame = atoi(colon + 1);
+	
+	return path_extension(path) == "fseq";
+}
+
+
+/**
+ * 
+ *   Read a flow into the planar buffers. .flo, PFM and .npy files are mapped and
+ *   decoded straight from the page cache; frames of a flow sequence, given as
+ *   "sequence.fseq:frame", are decoded into the buffers; other formats are
+ *   decoded by iio. The standard input, "-", is decoded from memory
+ * 
+ */
+bool read_flow(const char *fname, flow_buffer &flow)
+{
+	string path;
+	int frame;
 	
-	f = iio_read_image_float_vec(fname, &nx, &ny, &nz);
+	if(is_sequence_frame(fname, path, frame))
+	{
+		try
+		{
+			if(!flow.sequence || flow.sequence_path != path)
+			{
+				delete flow.sequence;
+				flow.sequence = NULL;
+				flow.sequence = new flow_sequence_reader(path);
+				flow.sequence_path = path;
+			}
+			
+			flow.nx = flow.sequence->nx();
+			flow.ny = flow.sequence->ny();
+			
+			float *u = flow.u.resize(flow.nx * flow.ny);
+			float *v = flow.v.resize(flow.nx * flow.ny);
+			
+			if(!u || !v) return false;
+			
+			flow.sequence->read(frame, u, v);
+			return true;
+		}
+		catch(const exception &e)
+		{
+			cerr << fname << ": " << e.what() << endl;
+			return false;
+		}
+	}
+	
+	vector<uint8_t> bytes;
+	const bool from_stdin = strcmp(fname, "-") == 0;
 	
-	if(nz > 0)
+	if(from_stdin && !read_stdin(bytes))
+		return false;
+	
+	if(from_stdin? is_flow(bytes.data(), bytes.size()): is_flow_file(fname))
 	{
-	    *u = new float[nx * ny];
-	    *v = new float[nx * ny];
-    
-	    int dg=1, db=2;
-	    
-	    if(nz == 1) dg=db=0;
-	    
-	    for(int i = 0; i < ny; i++)
-		for(int j = 0; j < nx; j++)
+		try
+		{
+			unique_ptr<mapped_file> file(from_stdin? NULL: new mapped_file(fname));
+			const uint8_t *data = file? file->data(): bytes.data();
+			const flow_layout layout = parse_flow(data, file? file->size(): bytes.size());
+			
+			flow.nx = layout.nx;
+			flow.ny = layout.ny;
+			
+			float *u = flow.u.resize(flow.nx * flow.ny);
+			float *v = flow.v.resize(flow.nx * flow.ny);
+			
+			if(!u || !v) return false;
+			
+			decode_flow(data, layout, u, v);
+			return true;
+		}
+		catch(const exception &e)
 		{
-		      (*u)[i*nx+j] = f[(i*nx+j)*2];
-		      (*v)[i*nx+j] = f[(i*nx+j)*2+1];
+			cerr << fname << ": " << e.what() << endl;
+			return false;
 		}
 	}
 	
-	return *u ? true : false;
+	int nz;
+	float *f = from_stdin? iio_read_image_float_vec_m(bytes.data(), bytes.size(), &flow.nx, &flow.ny, &nz):
+	                       iio_read_image_float_vec(fname, &flow.nx, &flow.ny, &nz);
+	
+	if(!f) return false;
+	
+	const int size = flow.nx * flow.ny;
+	float *u = flow.u.resize(size);
+	float *v = flow.v.resize(size);
+	
+	if(nz >= 2 && u && v)
+	    for(int i = 0; i < size; i++)
+	    {
+		u[i] = f[i * nz];
+		v[i] = f[i * nz + 1];
+	    }
+	
+	free(f);
+	
+	return nz >= 2 && u && v;
+}
+
+
+//inputs and outputs of one frame; a worker keeps them for all its frames
+struct frame_buffers
+{
+	image_buffer I1, I2;
+	flow_buffer  flow;
+	float_buffer u_, v_, m, scratch;
+};
+
+
+/**
+ * 
+ *   Read the two images and the flow of a frame, and size the outputs; the
+ *   buffers are only reallocated when the frame is larger than the previous ones
+ * 
+ */
+bool read_frame(const char *image1, const char *image2, const char *flow_in, frame_buffers &b)
+{
+	if(!read_image(image1, b.I1) || !read_image(image2, b.I2) || !read_flow(flow_in, b.flow))
+		return false;
+	
+	const int nx = b.I1.nx, ny = b.I1.ny;
+	
+	if(b.I2.nx != nx || b.I2.ny != ny || b.I2.nz != b.I1.nz || b.flow.nx != nx || b.flow.ny != ny)
+		return false;
+	
+	return b.u_.resize(nx * ny) && b.v_.resize(nx * ny) && b.m.resize(nx * ny);
 }
 
-void save_flow(const char *fname, float *u, float *v, int nx, int ny)
+
+/**
+ * 
+ *   Save the two components. .flo and PFM files are written straight from the
+ *   planar buffers; other formats are interleaved in the scratch buffer for iio
+ * 
+ */
+bool save_flow(const char *fname, const float *u, const float *v, int nx, int ny, float_buffer &scratch)
 {
-	//save the flow 
-	float *f = new float[nx * ny * 2];
+	if(writable_flow(fname))
+	{
+		try
+		{
+			write_flow(fname, u, v, nx, ny);
+			return true;
+		}
+		catch(const exception &e)
+		{
+			cerr << fname << ": " << e.what() << endl;
+			return false;
+		}
+	}
+	
+	float *f = scratch.resize(nx * ny * 2);
+	
+	if(!f) return false;
+	
 	for (int i = 0; i < nx * ny; i++) {
 		f[2*i] = u[i];
 		f[2*i+1] = v[i];
 	}
 	iio_save_image_float_vec(fname, f, nx, ny, 2);
-	delete []f;
+	
+	return true;
+}
+
+
+double elapsed_ms(const struct timespec &start, const struct timespec &end)
+{
+	return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+
+//one row of the batch manifest
+struct frame_job
+{
+	string image1, image2, flow_in, flow_out, mask_out;
+};
+
+struct frame_result
+{
+	bool   ok;
+	int    nx, ny;
+	double read_ms, inverse_ms, write_ms;
+	float  disocclusion_ratio;
+};
+
+
+/**
+ * 
+ *   Read the manifest: one frame per line, "I1 I2 flow_in flow_out [mask_out]",
+ *   empty lines and lines starting with # are skipped
+ * 
+ */
+bool read_manifest(const char *fname, vector<frame_job> &jobs)
+{
+	ifstream file(fname);
+	string line;
+	
+	if(!file) return false;
+	
+	while(getline(file, line))
+	{
+		istringstream row(line);
+		frame_job job;
+		
+		if(!(row >> job.image1) || job.image1[0] == '#') continue;
+		
+		if(!(row >> job.image2 >> job.flow_in >> job.flow_out))
+		{
+			cerr << "Malformed manifest row: " << line << endl;
+			return false;
+		}
+		row >> job.mask_out;
+		jobs.push_back(job);
+	}
+	
+	return true;
+}
+
+
+string json_string(const string &s)
+{
+	string r = "\"";
+	for(size_t i = 0; i < s.size(); i++)
+	{
+		const unsigned char c = s[i];
+		if(c == '"' || c == '\\') { r += '\\'; r += c; }
+		else if(c == '\n') r += "\\n";
+		else if(c == '\t') r += "\\t";
+		else if(c == '\r') r += "\\r";
+		else if(c < 0x20)
+		{
+			char code[7];
+			snprintf(code, sizeof(code), "\\u%04x", c);
+			r += code;
+		}
+		else r += c;
+	}
+	return r + "\"";
+}
+
+
+bool write_summary(
+    const char *fname, 
+    const vector<frame_job> &jobs, 
+    const vector<frame_result> &results,
+    int strategy,
+    int fill,
+    int threads,
+    double total_ms
+)
+{
+	FILE *f = fopen(fname, "w");
+	
+	if(!f) return false;
+	
+	fprintf(f, "{\n  \"strategy\": %d,\n  \"fill\": %d,\n  \"threads\": %d,\n", strategy, fill, threads);
+	fprintf(f, "  \"total_ms\": %.3f,\n  \"frames\": [", total_ms);
+	
+	for(size_t i = 0; i < jobs.size(); i++)
+	{
+		const frame_result &r = results[i];
+		fprintf(f, "%s\n    {\"flow_in\": %s, \"flow_out\": %s, \"ok\": %s", (i? ",": ""),
+			json_string(jobs[i].flow_in).c_str(), json_string(jobs[i].flow_out).c_str(), r.ok? "true": "false");
+		if(r.ok)
+			fprintf(f, ", \"nx\": %d, \"ny\": %d, \"read_ms\": %.3f, \"inverse_ms\": %.3f, \"write_ms\": %.3f, "
+				"\"disocclusion_ratio\": %.6f", r.nx, r.ny, r.read_ms, r.inverse_ms, r.write_ms, r.disocclusion_ratio);
+		fprintf(f, "}");
+	}
+	
+	fprintf(f, "\n  ]\n}\n");
+	
+	return fclose(f) == 0;
+}
+
+
+/**
+ * 
+ *   Process every frame of a manifest on a pool of workers. Each worker keeps its
+ *   output buffers from one frame to the next; iio is not reentrant, so reading and
+ *   writing files is serialized
+ * 
+ */
+int batch(int argc, char *argv[])
+{
+	if(argc < 4)
+	{
+		cout << "Usage: " << argv[0] << " --batch manifest summary.json [strategy fill threads distance budget_ms]" << endl;
+		return 1;
+	}
+
+	int i = 2;
+
+	const char *manifest = argv[i]; i++;
+	const char *summary  = argv[i]; i++;
+
+	const int   strategy = (argc > i)? atoi(argv[i]): AVG_IMAGE_METHOD; i++;
+	const int   fill     = (argc > i)? atoi(argv[i]): ORIENTED_FILL; i++;
+	int         threads  = (argc > i)? atoi(argv[i]): 0; i++;
+	const int   distance = (argc > i)? atoi(argv[i]): 0; i++;
+	const double budget  = (argc > i)? atof(argv[i]): 0; i++;
+
+	vector<frame_job> jobs;
+	
+	if(!read_manifest(manifest, jobs))
+	{
+		cerr << "Cannot read manifest " << manifest << endl;
+		return 1;
+	}
+
+#ifdef _OPENMP
+	if(threads > 0) omp_set_num_threads(threads);
+	threads = omp_get_max_threads();
+#else
+	threads = 1;
+#endif
+
+	vector<frame_result> results(jobs.size());
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+	#pragma omp parallel
+	{
+		frame_buffers b;
+
+		#pragma omp for schedule(dynamic)
+		for(int k = 0; k < (int) jobs.size(); k++)
+		{
+			const frame_job &job = jobs[k];
+			frame_result &r = results[k];
+			struct timespec t0, t1, t2, t3;
+			bool ok;
+			
+			r.ok = false;
+			clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+
+			#pragma omp critical(iio)
+			ok = read_frame(job.image1.c_str(), job.image2.c_str(), job.flow_in.c_str(), b);
+
+			if(ok)
+			{
+				const int nx = b.I1.nx, ny = b.I1.ny, size = nx * ny;
+
+				clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+				backward_flow(b.I1.data, b.I2.data, b.I1.nz, b.flow.u.data, b.flow.v.data, 
+					      b.u_.data, b.v_.data, b.m.data, nx, ny, strategy, fill, distance, budget);
+				clock_gettime(CLOCK_MONOTONIC_RAW, &t2);
+
+				int disoccluded = 0;
+				for(int p = 0; p < size; p++)
+					if(b.m.data[p] == DISOCCLUSION) disoccluded++;
+
+				#pragma omp critical(iio)
+				{
+					ok = save_flow(job.flow_out.c_str(), b.u_.data, b.v_.data, nx, ny, b.scratch);
+					if(ok && !job.mask_out.empty() && job.mask_out != "-")
+						ok = save_flow(job.mask_out.c_str(), b.m.data, b.m.data, nx, ny, b.scratch);
+				}
+				clock_gettime(CLOCK_MONOTONIC_RAW, &t3);
+
+				r.ok = ok;
+				r.nx = nx;
+				r.ny = ny;
+				r.read_ms    = elapsed_ms(t0, t1);
+				r.inverse_ms = elapsed_ms(t1, t2);
+				r.write_ms   = elapsed_ms(t2, t3);
+				r.disocclusion_ratio = (float) disoccluded / size;
+			}
+			else
+			{
+				#pragma omp critical(log)
+				cerr << "Cannot process " << job.flow_in << endl;
+			}
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+	if(!write_summary(summary, jobs, results, strategy, fill, threads, elapsed_ms(start, end)))
+	{
+		cerr << "Cannot write summary " << summary << endl;
+		return 1;
+	}
+
+	for(size_t k = 0; k < results.size(); k++)
+		if(!results[k].ok) return 1;
+
+	return 0;
+}
+
+
+//nearest-rank percentile of sorted times
+double percentile(const vector<double> &sorted, double p)
+{
+	int k = (int) ceil(p / 100 * sorted.size()) - 1;
+	if(k < 0) k = 0;
+	return sorted[k];
+}
+
+
+void print_times(const char *phase, vector<double> &times)
+{
+	sort(times.begin(), times.end());
+	printf(" %-8s %10.3f %10.3f %10.3f %10.3f", phase, 
+		times[0], percentile(times, 50), percentile(times, 95), percentile(times, 99));
+}
+
+
+/**
+ * 
+ *   Repeat the estimation on in-memory data for every strategy and fill, and
+ *   report the distribution of the inversion, fill and total times
+ * 
+ */
+int bench(int argc, char *argv[])
+{
+	int i = 2;
+	int runs = 0, warmup = 1;
+
+	if(argc > i) runs = atoi(argv[i]);
+	i++;
+
+	if(argc > i + 1 && strcmp(argv[i], "--warmup") == 0)
+	{
+		warmup = atoi(argv[i + 1]);
+		i += 2;
+	}
+
+	if(runs <= 0 || warmup < 0 || argc < i + 3)
+	{
+		cout << "Usage: " << argv[0] << " --bench N [--warmup K] I1 I2 flow_in" << endl;
+		return 1;
+	}
+
+	const char *image1  = argv[i]; i++;
+	const char *image2  = argv[i]; i++;
+	const char *flow_in = argv[i]; i++;
+
+	frame_buffers b;
+
+	if(!read_frame(image1, image2, flow_in, b))
+	{
+		cerr << "Cannot read the input images and flow" << endl;
+		return 1;
+	}
+
+	const int nx = b.I1.nx, ny = b.I1.ny;
+	vector<double> inverse_ms(runs), fill_ms(runs), total_ms(runs);
+
+	printf("%d x %d, %d runs after %d warmup, times in ms\n", nx, ny, runs, warmup);
+	printf("strategy fill %-8s %10s %10s %10s %10s\n", "phase", "min", "median", "p95", "p99");
+
+	for(int strategy = MAX_FLOW_METHOD; strategy <= AVG_IMAGE_METHOD; strategy++)
+		for(int fill = 0; fill <= BOUNDED_FILL; fill++)
+		{
+			for(int r = -warmup; r < runs; r++)
+			{
+				struct timespec t0, t1, t2;
+
+				clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+				inverse_backward_flow(b.I1.data, b.I2.data, b.I1.nz, b.flow.u.data, b.flow.v.data, 
+						      b.u_.data, b.v_.data, b.m.data, nx, ny, strategy);
+				clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+				fill_backward_flow(b.flow.u.data, b.flow.v.data, b.u_.data, b.v_.data, b.m.data, nx, ny, strategy, fill);
+				clock_gettime(CLOCK_MONOTONIC_RAW, &t2);
+
+				if(r < 0) continue;
+
+				inverse_ms[r] = elapsed_ms(t0, t1);
+				fill_ms[r]    = elapsed_ms(t1, t2);
+				total_ms[r]   = elapsed_ms(t0, t2);
+			}
+
+			const char *phases[] = {"inverse", "fill", "total"};
+			vector<double> *times[] = {&inverse_ms, &fill_ms, &total_ms};
+
+			for(int p = 0; p < 3; p++)
+			{
+				printf("%8d %4d", strategy, fill);
+				print_times(phases[p], *times[p]);
+				printf("\n");
+			}
+		}
+
+	return 0;
+}
+
+
+/**
+ * 
+ *   Pack flows into a compressed flow sequence, lossless or quantized to
+ *   multiples of the step
+ * 
+ */
+int pack(int argc, char *argv[])
+{
+	int i = 2;
+	float step = 0;
+
+	const char *sequence = (argc > i)? argv[i]: NULL; i++;
+
+	if(argc > i + 1 && strcmp(argv[i], "--step") == 0)
+	{
+		step = atof(argv[i + 1]);
+		i += 2;
+	}
+
+	if(!sequence || argc <= i)
+	{
+		cout << "Usage: " << argv[0] << " --pack sequence.fseq [--step q] flow..." << endl;
+		return 1;
+	}
+
+	try
+	{
+		flow_buffer flow;
+		unique_ptr<flow_sequence_writer> writer;
+
+		for(; i < argc; i++)
+		{
+			if(!read_flow(argv[i], flow))
+			{
+				cerr << "Cannot read " << argv[i] << endl;
+				return 1;
+			}
+
+			if(!writer)
+				writer.reset(new flow_sequence_writer(sequence, flow.nx, flow.ny, step));
+			else if(flow.nx != writer->nx() || flow.ny != writer->ny())
+			{
+				cerr << argv[i] << ": all the flows of a sequence must have the same size" << endl;
+				return 1;
+			}
+
+			writer->write(flow.u.data, flow.v.data);
+		}
+
+		writer->close();
+	}
+	catch(const exception &e)
+	{
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
 }
 
 
 int main(int argc, char *argv[])
 {
+	if(argc > 1 && strcmp(argv[1], "--batch") == 0)
+		return batch(argc, argv);
+
+	if(argc > 1 && strcmp(argv[1], "--bench") == 0)
+		return bench(argc, argv);
+
+	if(argc > 1 && strcmp(argv[1], "--pack") == 0)
+		return pack(argc, argv);
+
 	if(argc < 4)
-		cout << "Usage: " << argv[0] << " I1 I2 flow_in [flow_out mask fill strategy]" << endl;
+	{
+		cout << "Usage: " << argv[0] << " I1 I2 flow_in [flow_out mask strategy fill verbose distance budget_ms]" << endl;
+		cout << "       " << argv[0] << " --batch manifest summary.json [strategy fill threads distance budget_ms]" << endl;
+		cout << "       " << argv[0] << " --bench N [--warmup K] I1 I2 flow_in" << endl;
+		cout << "       " << argv[0] << " --pack sequence.fseq [--step q] flow..." << endl;
+	}
 	else
 	{
-		int nx, ny, nz;
-
 		int i = 1;
 
 		const char *image1   = argv[i]; i++;
@@ -103,47 +729,36 @@ int main(int argc, char *argv[])
 		const int   strategy = (argc > i)? atoi(argv[i]): AVG_IMAGE_METHOD; i++;
 		const int   fill     = (argc > i)? atoi(argv[i]): ORIENTED_FILL; i++;
 		const int   verbose  = (argc > i)? atoi(argv[i]): 0; i++;
+		const int   distance = (argc > i)? atoi(argv[i]): 0; i++;
+		const double budget  = (argc > i)? atof(argv[i]): 0; i++;
 		
-		float *I1r, *I1g, *I1b, *I2r, *I2g, *I2b;
+		frame_buffers b;
 		
-		if(read_image(image1, &I1r, &I1g, &I1b, nx, ny, nz) &&
-		   read_image(image2, &I2r, &I2g, &I2b, nx, ny, nz))
+		if(read_frame(image1, image2, flow_in, b))
 		{
-		    float *u, *v, *u_, *v_, *m;
-
-		    read_flow(flow_in, &u, &v, nx, ny);
-		    
-		    u_ = new float[nx * ny];
-		    v_ = new float[nx * ny];
-		    m  = new float[nx * ny];
+		    const int nx = b.I1.nx, ny = b.I1.ny;
 		    
 		    if(verbose)
 		      cout << "strategy = " << strategy << " fill = " << fill << endl;
 
-		    float diff;
 		    struct timespec start, end;
 		    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
-		    backward_flow(I1r, I1g, I1b, I2r, I2g, I2b, u, v, u_, v_, m, nx, ny, strategy, fill);
+		    backward_flow(b.I1.data, b.I2.data, b.I1.nz, b.flow.u.data, b.flow.v.data, 
+				  b.u_.data, b.v_.data, b.m.data, nx, ny, strategy, fill, distance, budget);
 		    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
-		    diff = (float) (end.tv_nsec - start.tv_nsec)/1000000;
 		    cout.precision(8);
-		    cout << "Time: " << diff << endl;
+		    cout << "Time: " << elapsed_ms(start, end) << endl;
 		    
-		    save_flow(flow_out, u_, v_, nx, ny);
+		    bool ok = save_flow(flow_out, b.u_.data, b.v_.data, nx, ny, b.scratch);
 		    
-		    if(mask_out) save_flow(mask_out, m, m, nx, ny);
-
-		    delete []I1r;
-		    delete []I1g;
-		    delete []I1b;
-		    delete []I2r;
-		    delete []I2g;
-		    delete []I2b;
-		    delete []u;
-		    delete []v;
-		    delete []u_;
-		    delete []v_;
-		    delete []m;
+		    if(mask_out) ok = save_flow(mask_out, b.m.data, b.m.data, nx, ny, b.scratch) && ok;
+		    
+		    if(!ok) return 1;
+		}
+		else
+		{
+		    cerr << "Cannot read the input images and flow" << endl;
+		    return 1;
 		}
 	}
 }
@@ -2,6 +2,7 @@
 #define _INVERSE_OPTIC_FLOW_H
 
 #include "fill_disocclusions.h"
+#include "../src/flow_fill.h"
 #include <cfloat>
 
 //constants definition for inverse optical flow algorithms
@@ -15,6 +16,22 @@
 #define WEIGHT_TH 0.25
 #define MOTION_TH 0.25
 
+/**
+ * 
+ *   Squared color distance between two pixels of interleaved images with nz
+ *   channels per pixel. Gray images compare their only channel three times
+ * 
+ */
+inline float color_distance(const float *p1, const float *p2, const int nz)
+{
+    const int g = (nz < 3)? 0: 1;
+    const int b = (nz < 3)? 0: 2;
+
+    return (p1[0] - p2[0]) * (p1[0] - p2[0]) + 
+	   (p1[g] - p2[g]) * (p1[g] - p2[g]) + 
+	   (p1[b] - p2[b]) * (p1[b] - p2[b]);
+}
+
 /**
  * 
  *   Function to compute the backward flow from the forward flow
@@ -117,12 +134,9 @@ void inverse_flow(
  * 
  */
 void inverse_image_max_flow(
-    const float *I1r,
-    const float *I1g,
-    const float *I1b,
-    const float *I2r,
-    const float *I2g,
-    const float *I2b,
+    const float *I1,
+    const float *I2,
+    const int    nz,
     const float *u, 
     const float *v, 
     float       *u_, 
@@ -182,18 +196,10 @@ void inverse_image_max_flow(
 	    const float w3 = E1 * e2;
 	    const float w4 = e1 * e2;
 
-	    const float d1 = (I1r[pos] - I2r[pos1]) * (I1r[pos] - I2r[pos1]) + 
-			     (I1g[pos] - I2g[pos1]) * (I1g[pos] - I2g[pos1]) + 
-			     (I1b[pos] - I2b[pos1]) * (I1b[pos] - I2b[pos1]);
-	    const float d2 = (I1r[pos] - I2r[pos2]) * (I1r[pos] - I2r[pos2]) + 
-			     (I1g[pos] - I2g[pos2]) * (I1g[pos] - I2g[pos2]) + 
-			     (I1b[pos] - I2b[pos2]) * (I1b[pos] - I2b[pos2]);
-	    const float d3 = (I1r[pos] - I2r[pos3]) * (I1r[pos] - I2r[pos3]) + 
-			     (I1g[pos] - I2g[pos3]) * (I1g[pos] - I2g[pos3]) + 
-			     (I1b[pos] - I2b[pos3]) * (I1b[pos] - I2b[pos3]);
-	    const float d4 = (I1r[pos] - I2r[pos4]) * (I1r[pos] - I2r[pos4]) + 
-			     (I1g[pos] - I2g[pos4]) * (I1g[pos] - I2g[pos4]) + 
-			     (I1b[pos] - I2b[pos4]) * (I1b[pos] - I2b[pos4]);
+	    const float d1 = color_distance(I1 + pos * nz, I2 + pos1 * nz, nz);
+	    const float d2 = color_distance(I1 + pos * nz, I2 + pos2 * nz, nz);
+	    const float d3 = color_distance(I1 + pos * nz, I2 + pos3 * nz, nz);
+	    const float d4 = color_distance(I1 + pos * nz, I2 + pos4 * nz, nz);
 
 	    if(w1 >= WEIGHT_TH && DI[pos1] >= d1)
 	    {
@@ -227,6 +233,8 @@ void inverse_image_max_flow(
 		mask[pos4] = NO_DISOCCLUSION;
 	    }
 	} 
+
+      delete []DI;
 }
 
 
@@ -420,12 +428,9 @@ inline void select_image_motion(
  * 
  */
 void inverse_image_average_flow(
-    const float *I1r,
-    const float *I1g,
-    const float *I1b,
-    const float *I2r,
-    const float *I2g,
-    const float *I2b,
+    const float *I1,
+    const float *I2,
+    const int    nz,
     const float *u, 
     const float *v, 
     float       *u_, 
@@ -494,18 +499,10 @@ void inverse_image_average_flow(
 	    const float w3 = E1 * e2;
 	    const float w4 = e1 * e2;
 
-	    const float dI1 = (I1r[pos] - I2r[pos1]) * (I1r[pos] - I2r[pos1]) + 
-			     (I1g[pos] - I2g[pos1]) * (I1g[pos] - I2g[pos1]) + 
-			     (I1b[pos] - I2b[pos1]) * (I1b[pos] - I2b[pos1]);
-	    const float dI2 = (I1r[pos] - I2r[pos2]) * (I1r[pos] - I2r[pos2]) + 
-			     (I1g[pos] - I2g[pos2]) * (I1g[pos] - I2g[pos2]) + 
-			     (I1b[pos] - I2b[pos2]) * (I1b[pos] - I2b[pos2]);
-	    const float dI3 = (I1r[pos] - I2r[pos3]) * (I1r[pos] - I2r[pos3]) + 
-			     (I1g[pos] - I2g[pos3]) * (I1g[pos] - I2g[pos3]) + 
-			     (I1b[pos] - I2b[pos3]) * (I1b[pos] - I2b[pos3]);
-	    const float dI4 = (I1r[pos] - I2r[pos4]) * (I1r[pos] - I2r[pos4]) + 
-			     (I1g[pos] - I2g[pos4]) * (I1g[pos] - I2g[pos4]) + 
-			     (I1b[pos] - I2b[pos4]) * (I1b[pos] - I2b[pos4]);
+	    const float dI1 = color_distance(I1 + pos * nz, I2 + pos1 * nz, nz);
+	    const float dI2 = color_distance(I1 + pos * nz, I2 + pos2 * nz, nz);
+	    const float dI3 = color_distance(I1 + pos * nz, I2 + pos3 * nz, nz);
+	    const float dI4 = color_distance(I1 + pos * nz, I2 + pos4 * nz, nz);
 
 	    select_image_motion(
 	      dI1, u[pos], v[pos], w1, d_[pos1], dI[pos1], avg_u[pos1], 
@@ -548,16 +545,14 @@ void inverse_image_average_flow(
 
 /**
  * 
- *   Function to compute the backward flow from the forward flow
+ *   Function to estimate the backward flow and the disocclusion mask,
+ *   without filling the disocclusions
  * 
  */
-int backward_flow(
-    const float *I1r,
-    const float *I1g,
-    const float *I1b,
-    const float *I2r,
-    const float *I2g,
-    const float *I2b,
+void inverse_backward_flow(
+    const float *I1,
+    const float *I2,
+    const int    nz,
     const float *u, 
     const float *v, 
     float       *u_, 
@@ -565,8 +560,7 @@ int backward_flow(
     float       *mask,
     int 	 	nx, 
     int 	 	ny,
-    int		strategy,
-    int		fill
+    int		strategy
 )
 {
     int size = nx * ny;
@@ -585,7 +579,7 @@ int backward_flow(
 	      break;
 	      
       case MAX_IMAGE_METHOD: 
-	      inverse_image_max_flow(I1r, I1g, I1b, I2r, I2g, I2b, u, v, u_, v_, mask, nx, ny);
+	      inverse_image_max_flow(I1, I2, nz, u, v, u_, v_, mask, nx, ny);
 	      break;
 	      
       case AVG_FLOW_METHOD: 
@@ -593,20 +587,81 @@ int backward_flow(
 	      break;
 	      
       case AVG_IMAGE_METHOD: default:
-	      inverse_image_average_flow(I1r, I1g, I1b, I2r, I2g, I2b, u, v, u_, v_, mask, nx, ny);
+	      inverse_image_average_flow(I1, I2, nz, u, v, u_, v_, mask, nx, ny);
 	      break;
     }
-    
+}
+
+
+/**
+ * 
+ *   Function to fill the disocclusions of the backward flow. The bounded fill
+ *   stops after max_distance rings or budget_ms milliseconds, when positive, and
+ *   leaves the holes it did not reach flagged in the mask
+ * 
+ */
+void fill_backward_flow(
+    const float *u, 
+    const float *v, 
+    float       *u_, 
+    float       *v_,
+    float       *mask,
+    int 	 	nx, 
+    int 	 	ny,
+    int		strategy,
+    int		fill,
+    int		max_distance = 0,
+    double	budget_ms = 0
+)
+{
+    int size = nx * ny;
+
     if(fill == MIN_FILL) 
       restricted_minfill(u_, v_, mask, nx, ny);
     else if(fill == AVERAGE_FILL)
       average_fill(u_, v_, mask, nx, ny);
     else if(fill == ORIENTED_FILL)
       oriented_fill(u, v, u_, v_, mask, nx, ny);
+    else if(fill == NEAREST_FILL)
+      nearest_fill(u_, v_, mask, nx, ny);
+    else if(fill == PUSH_PULL_FILL)
+      push_pull_fill(u_, v_, mask, (float) NO_DISOCCLUSION, ny, nx);
+    else if(fill == HARMONIC_FILL)
+      harmonic_fill(u_, v_, mask, (float) NO_DISOCCLUSION, ny, nx);
+    else if(fill == BOUNDED_FILL)
+      bounded_fill(u_, v_, mask, (float) NO_DISOCCLUSION, ny, nx, max_distance, (int64_t) (budget_ms * 1e6));
     else if(strategy==MAX_FLOW_METHOD)
       for(int i = 0; i < size; i++)
 	if(mask[i] == DISOCCLUSION)
 	  u_[i] = v_[i] = OCCLUSION;
+}
+
+
+/**
+ * 
+ *   Function to compute the backward flow from the forward flow; I1 and I2 are
+ *   the interleaved images, with nz channels per pixel
+ * 
+ */
+int backward_flow(
+    const float *I1,
+    const float *I2,
+    const int    nz,
+    const float *u, 
+    const float *v, 
+    float       *u_, 
+    float       *v_,
+    float       *mask,
+    int 	 	nx, 
+    int 	 	ny,
+    int		strategy,
+    int		fill,
+    int		max_distance = 0,
+    double	budget_ms = 0
+)
+{
+    inverse_backward_flow(I1, I2, nz, u, v, u_, v_, mask, nx, ny, strategy);
+    fill_backward_flow(u, v, u_, v_, mask, nx, ny, strategy, fill, max_distance, budget_ms);
 
     return 0;
 }
@@ -1,13 +1,23 @@
 #ifndef FILL_DISOCCLUSIONS
 #define FILL_DISOCCLUSIONS
 
+#include <atomic>
 #include <cmath>
+#include <cstdlib>
 #include <vector>
 #include <algorithm>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #define MIN_FILL  1
 #define AVERAGE_FILL 2
 #define ORIENTED_FILL 3
+#define NEAREST_FILL 4
+#define PUSH_PULL_FILL 5
+#define HARMONIC_FILL 6
+#define BOUNDED_FILL 7
 
 #define NO_DISOCCLUSION 1
 #define DISOCCLUSION 0
@@ -15,8 +25,65 @@
 #define STREETLAMP_DISOCCLUSION -2
 
 
-//Two pass algorithm for labelling regions - connected-component labelling algorithm
-//returns the number of layers found
+//root of a node of the union-find forest, halving the path on the way; a
+//node only ever points to one of its ancestors, so the halving is a plain store
+inline int find_root(std::atomic<int> *parent, int x)
+{
+    int p = parent[x].load(std::memory_order_relaxed);
+    
+    while(p != x)
+    {
+	const int gp = parent[p].load(std::memory_order_relaxed);
+	
+	if(gp != p) parent[x].store(gp, std::memory_order_relaxed);
+	
+	x = p;
+	p = gp;
+    }
+    
+    return x;
+}
+
+
+//lock-free union: the larger root is linked to the smaller one, so every tree
+//ends up rooted at its first node in raster order
+inline void unite(std::atomic<int> *parent, int a, int b)
+{
+    while(true)
+    {
+	a = find_root(parent, a);
+	b = find_root(parent, b);
+	
+	if(a == b) return;
+	if(a < b) std::swap(a, b);
+	
+	int expected = a;
+	if(parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed))
+	    return;
+    }
+}
+
+
+//run of disoccluded pixels of a row, and its node in the union-find forest
+struct run_node
+{
+    int node, start, end;
+    
+    run_node(int n, int s, int e): node(n), start(s), end(e) {}
+};
+
+
+/**
+ * 
+ *   Connected-component labelling of the disoccluded pixels, 4-connected.
+ *   The rows are split in one strip per thread. Each strip labels its runs of
+ *   disoccluded pixels and merges them with the runs above in a union-find forest
+ *   whose nodes are the runs, numbered row by row; then the runs on both sides
+ *   of the strip borders are merged, and the roots are numbered in raster order.
+ *   Labels go from 1 to the number of regions, which is returned; 0 is not
+ *   disoccluded
+ * 
+ */
 int connected_component_labeling(
     float *mask,
     int   *regions,
@@ -24,98 +91,144 @@ int connected_component_labeling(
     int    ny 
 )
 {
-    int label = 1;
-    
-    std::vector<int> corresponding_label;
+    //a row has at most (nx + 1) / 2 runs
+    const int row_nodes = (nx + 1) / 2;
     
-    corresponding_label.push_back(0);
+    std::atomic<int> *parent = new std::atomic<int>[(long) row_nodes * ny];
+    std::vector<int>  roots;
     
-    for(int i = 0; i < nx * ny; i++) regions[i] = 0;
-        
-    //first pass for initial labelling
-    for(int i = 0; i < ny; i++)
-
-	for(int j = 0; j < nx; j++)
+    #pragma omp parallel
+    {
+#ifdef _OPENMP
+	const int strips = omp_get_num_threads();
+	const int s = omp_get_thread_num();
+#else
+	const int strips = 1;
+	const int s = 0;
+#endif
+	const int y0 = (int) ((long) ny * s / strips);
+	const int y1 = (int) ((long) ny * (s + 1) / strips);
+	
+	//runs of the strip: node, first pixel and pixel after the last one
+	std::vector<run_node> runs;
+	
+	#pragma omp single
+	roots.assign(strips + 1, 0);
+	
+	//runs of the strip, merged with the runs above them; only this thread
+	//links the trees of the strip, without atomic operations
+	for(int i = y0; i < y1; i++)
 	{
-	    int p = i * nx + j;
-
-	    if(mask[p] == DISOCCLUSION)
+	    int p = i * nx;
+	    int n = i * row_nodes;
+	    const int row_end = p + nx;
+	    
+	    while(p < row_end)
 	    {
-		int l1 = 0;
-		int l2 = 0;
-
-		//take neighbors labels
-		if(i-1 >= 0) l1 = regions[p - nx];
-		if(j-1 >= 0) l2 = regions[p - 1];
-
-		if(l1 > 0 || l2 > 0)
+		if(mask[p] != DISOCCLUSION)
 		{
-		    if(l1 > 0)
+		    regions[p++] = 0;
+		    continue;
+		}
+		
+		const int first = p;
+		int root = n, above = 0;
+		
+		parent[n].store(n, std::memory_order_relaxed);
+		
+		for(; p < row_end && mask[p] == DISOCCLUSION; p++)
+		{
+		    regions[p] = n + 1;
+		    
+		    const int q = (i > y0)? regions[p - nx]: 0;
+		    
+		    if(q > 0 && q != above)
 		    {
-			if(l2 > 0)
+			const int r = find_root(parent, q - 1);
+			
+			if(r < root)
 			{
-			    int c = std::min(corresponding_label[l1], corresponding_label[l2]); 
-			 
-			    corresponding_label[l1] = c;
-			    corresponding_label[l2] = c;
-			 
-			    regions[p] = c;
+			    parent[root].store(r, std::memory_order_relaxed);
+			    root = r;
 			}
-			else
-			    regions[p] = l1;
+			else if(r > root)
+			    parent[r].store(root, std::memory_order_relaxed);
 		    }
-		    else 
-			regions[p] = l2;
-		}
-		else
-		{
-		    regions[p] = label;    
-		    corresponding_label.push_back(label);
-		    label++;
+		    above = q;
 		}
+		
+		runs.push_back(run_node(n, first, p));
+		n++;
 	    }
 	}
 	
-    //unify labels
-    for(int i = 2; i < (int) corresponding_label.size(); i++)
-    {
-	int c = corresponding_label[i];
+	#pragma omp barrier
 	
-	while(c != corresponding_label[c]) 
-	    c = corresponding_label[c];
+	//merge the runs across the top border of the strip
+	if(y0 > 0 && y0 < y1)
+	    for(int p = y0 * nx; p < (y0 + 1) * nx; p++)
+		if(regions[p] > 0 && regions[p - nx] > 0)
+		    unite(parent, regions[p] - 1, regions[p - nx] - 1);
 	
-	corresponding_label[i] = c;
+	#pragma omp barrier
+	
+	//count the roots of the strip, then number them after the previous strips
+	int count = 0;
+	for(int r = 0; r < (int) runs.size(); r++)
+	    if(parent[runs[r].node].load(std::memory_order_relaxed) == runs[r].node)
+		count++;
+	roots[s + 1] = count;
+	
+	#pragma omp barrier
+	
+	#pragma omp single
+	for(int k = 0; k < strips; k++) roots[k + 1] += roots[k];
+	
+	//roots hold the opposite of their label, other nodes their parent
+	int label = roots[s];
+	for(int r = 0; r < (int) runs.size(); r++)
+	    if(parent[runs[r].node].load(std::memory_order_relaxed) == runs[r].node)
+		parent[runs[r].node].store(-(++label), std::memory_order_relaxed);
+	
+	#pragma omp barrier
+	
+	for(int r = 0; r < (int) runs.size(); r++)
+	{
+	    int x = runs[r].node;
+	    int q;
+	    
+	    while((q = parent[x].load(std::memory_order_relaxed)) >= 0) x = q;
+	    
+	    std::fill(regions + runs[r].start, regions + runs[r].end, -q);
+	}
     }
-
-    //second pass for simplifying labels
-    for(int i = 0; i < ny * nx; i++)
-	regions[i] = corresponding_label[regions[i]];
     
-    return *(std::max_element(corresponding_label.begin(), corresponding_label.end()));
+    delete []parent;
+    
+    return roots.back();
 }
 
-void save_regions(int *regions, int nx, int ny, int labels)
+/**
+ * 
+ *   Debug view of the regions, for inspection only: two interleaved channels
+ *   per pixel, the sine of an angle growing with the label and the cosine of a
+ *   pseudo-random angle of the label, 0 outside the regions
+ * 
+ */
+void save_regions(const int *regions, float *view, int nx, int ny, int labels)
 {
-    float *r1 = new float[nx * ny];
-    float *r2 = new float[nx * ny];
-
-    std::vector<float> ang;
-    ang.push_back(0);
-    
-    for(int i = 1; i < labels; i++) ang.push_back((float)rand()/RAND_MAX);
-
-	for(int i = 0; i < nx * ny; i++)
-	{
-	    r1[i] = (regions[i]==0)?0:sin(2*3.141592*regions[i]/labels);
-	    r2[i] = (regions[i]==0)?0:cos(2*3.141592*ang[regions[i]]);
-	}
-
-    delete []r1;
-    delete []r2;
+    for(int i = 0; i < nx * ny; i++)
+    {
+	const int r = regions[i];
+	const float angle = (float) ((unsigned) r * 2654435761u) / 4294967296.0f;
+	
+	view[2 * i]     = (r == 0)? 0: sin(2 * 3.141592 * r / labels);
+	view[2 * i + 1] = (r == 0)? 0: cos(2 * 3.141592 * angle);
+    }
 }
 
 
-inline void min_test(float *mask, float *u, float *v, float *mu, float *mv, float *d, int i, int l)
+inline void min_test(const float *mask, const float *u, const float *v, int i, float &mu, float &mv, float &md)
 {
     if(mask[i] != DISOCCLUSION)
     {
@@ -123,18 +236,21 @@ inline void min_test(float *mask, float *u, float *v, float *mu, float *mv, floa
 	const float vv = v[i];
 	const float dd = uu * uu + vv * vv;
 	
-	if(dd < d[l])
+	if(dd < md)
 	{
-	    d[l]  = dd;
-	    mu[l] = uu;
-	    mv[l] = vv;
+	    md = dd;
+	    mu = uu;
+	    mv = vv;
 	}
     }   
 }
 
 /**
  * 
- *   Function to fill the empty regions with the min neighbor value
+ *   Function to fill the empty regions with the min neighbor value. Every
+ *   region is an independent task, which searches the minimum around the
+ *   region and fills it; with regions_view, the debug view of the regions is
+ *   also saved there (2 * nx * ny floats)
  * 
  */
 void minfill(
@@ -142,63 +258,89 @@ void minfill(
     float *v, 
     float *mask,
     int    nx, 
-    int    ny 
+    int    ny,
+    float *regions_view = NULL
 )
 {
-    int *regions = new int[nx * ny];
+    const int size = nx * ny;
+    
+    int *regions = new int[size];
 
     //classify the regions and assign labels
     const int labels = connected_component_labeling(mask, regions, nx, ny);
 
-    save_regions(regions, nx, ny, labels);
+    if(regions_view) save_regions(regions, regions_view, nx, ny, labels);
+    
+    //pixels of every region, in raster order: first[l] is the first one of label l+1
+    int *first = new int[labels + 1];
     
-    //search for the minimum around every region
-    float *min_u = new float[labels];
-    float *min_v = new float[labels];
-    float *min_d = new float[labels];
+    for(int l = 0; l <= labels; l++) first[l] = 0;
+    for(int i = 0; i < size; i++) 
+	if(regions[i] > 0) first[regions[i]]++;
+    for(int l = 0; l < labels; l++) first[l + 1] += first[l];
     
-    for(int i = 0; i < labels; i++)
-	min_u[i] = min_v[i] = min_d[i] = 99999.9;
+    int *pixels = new int[first[labels]];
     
-    for(int i = 0; i < ny; i++)
+    for(int i = 0; i < size; i++) 
+	if(regions[i] > 0) pixels[first[regions[i] - 1]++] = i;
+    for(int l = labels; l > 0; l--) first[l] = first[l - 1];
+    first[0] = 0;
+    
+    //search for the minimum around every region and fill it; the filled pixels
+    //are not read by the other regions
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(int l = 0; l < labels; l++)
+    {
+	float min_u = 99999.9, min_v = 99999.9, min_d = 99999.9;
 	
-	for(int j = 0; j < nx; j++)
+	for(int k = first[l]; k < first[l + 1]; k++)
 	{
-	      int p = i * nx + j;
-	      
-	      if(mask[p] == DISOCCLUSION)
-	      {
-		  const int l = regions[p]-1;
-		  if(i >    0) min_test(mask, u, v, min_u, min_v, min_d, p-nx, l);
-		  if(i < ny-1) min_test(mask, u, v, min_u, min_v, min_d, p+nx, l);
-		  if(j >    0) min_test(mask, u, v, min_u, min_v, min_d, p-1,  l);
-		  if(j < nx-1) min_test(mask, u, v, min_u, min_v, min_d, p+1,  l);
-	      }
+	    const int p = pixels[k];
+	    const int i = p / nx;
+	    const int j = p - i * nx;
+	    
+	    if(i >    0) min_test(mask, u, v, p-nx, min_u, min_v, min_d);
+	    if(i < ny-1) min_test(mask, u, v, p+nx, min_u, min_v, min_d);
+	    if(j >    0) min_test(mask, u, v, p-1,  min_u, min_v, min_d);
+	    if(j < nx-1) min_test(mask, u, v, p+1,  min_u, min_v, min_d);
 	}
 	
-    //fill the holes with the minimum values around the region
-    for(int i = 0; i < nx * ny; i++)
-
-	if(mask[i] == DISOCCLUSION)
+	for(int k = first[l]; k < first[l + 1]; k++)
 	{
-	    const int l = regions[i]-1;
-	    
-	    u[i] = min_u[l];
-	    v[i] = min_v[l];
+	    u[pixels[k]] = min_u;
+	    v[pixels[k]] = min_v;
 	}
+    }
 	    
-    delete []min_u;
-    delete []min_v;
-    delete []min_d;
+    delete []first;
+    delete []pixels;
     delete []regions;
 }
 
 
 
 
+//window searched around (i, j): rows [k0, k1) and columns [l0, l1)
+inline void fill_window(int i, int j, int nx, int ny, int radius, int &k0, int &k1, int &l0, int &l1)
+{
+    k0 = (i-radius>0)? i-radius: 0;
+    k1 = (i+radius<ny)? i+radius: ny-1;
+    l0 = (j-radius>0)? j-radius: 0;
+    l1 = (j+radius<nx)? j+radius: nx-1;
+}
+
+
 /**
  * 
- *   Function to fill the empty regions with the closest min value
+ *   Function to fill the empty regions with the closest min value.
+ * 
+ *   Every iteration fills a hole with the minimum of its window, taken from the
+ *   valid pixels and the holes filled by the previous iteration; the holes filled
+ *   by the previous iteration are not searched, the two masks being swapped. So
+ *   a hole first filled at iteration b is filled again at b + 2, b + 4... until
+ *   the iteration that reaches the last holes. An iteration only depends on the
+ *   holes changed by the previous one, so instead of scanning the image it
+ *   searches the holes seen by them, and the work follows the holes
  * 
  */
 void restricted_minfill(
@@ -210,73 +352,244 @@ void restricted_minfill(
     int    radius = 5
 )
 {
-    float *mask2 = new float[nx * ny];
-    float *mask3 = new float[nx * ny];
-
-    for(int i = 0; i < nx * ny; i++) mask2[i] = mask3[i] = mask[i];
-
-    bool end;
+    const int size = nx * ny;
+    
+    //iteration at which every hole was first filled, 0 while it is not; only
+    //the pages around the holes are ever touched
+    int *reached = (int *) std::calloc(size, sizeof(int));
+    
+    //holes to search in the current iteration, and holes it changed
+    std::vector<int> next, changed;
+    //runs of changed holes, and the columns they are seen from in a row
+    std::vector<std::pair<int, int> > spans, columns;
+    //first minimum of the window row k in column j, for the last rows searched,
+    //in the ring row k % rows; and the sliding queue that finds them
+    const int rows = std::max(2 * radius, 1);
+    std::vector<int> row_k(rows * nx), row_q(rows * nx), row_d(rows * nx);
+    std::vector<int> window_d, window_l;
+    int holes = 0;
+    
+    for(int i = 0; i < size; i++)
+	if(mask[i] == DISOCCLUSION)
+	{
+	    next.push_back(i);
+	    holes++;
+	}
 
-    do 
+    for(int t = 1; !next.empty(); t++)
     {
-	end = true;
-
-	for(int i = 0; i < ny; i++)
-	    for(int j = 0; j < nx; j++)
+	int found = 0;
+	
+	changed.clear();
+	std::fill(row_k.begin(), row_k.end(), -1);
+	
+	for(int n = 0; n < (int) next.size();)
+	{
+	    //run of holes in the columns [a, a + len) of row i
+	    const int i = next[n] / nx;
+	    const int a = next[n] - i * nx;
+	    
+	    int m = n + 1;
+	    while(m < (int) next.size() && next[m] == next[m-1] + 1 && next[m] - i * nx < nx) m++;
+	    
+	    const int len = m - n;
+	    
+	    int k0, k1, l0, l1;
+	    fill_window(i, a, nx, ny, radius, k0, k1, l0, l1);
+	    
+	    if((int) window_d.size() < len + 2 * radius)
 	    {
-		const int p = i * nx + j;
-		//if there is a disocclusion, then try to fill it up
-		if(mask2[p] == DISOCCLUSION)
+		window_d.resize(len + 2 * radius);
+		window_l.resize(len + 2 * radius);
+	    }
+	    
+	    //first minimum of every row of the windows, unless the rows above already
+	    //left it in the ring; along long runs it slides, the queue keeping the
+	    //sources that may still be the minimum
+	    for(int k = k0; k < k1; k++)
+	    {
+		const int slot = (k % rows) * nx + a;
+		
+		int j = 0;
+		while(j < len && row_k[slot + j] == k) j++;
+		if(j == len) continue;
+		
+		int head = 0, tail = 0;
+		int l = l0;
+		
+		for(j = 0; j < len; j++)
 		{
-		    float min_d = 99999.9;
-		    float min_u = 99999.9;
-		    float min_v = 99999.9;
-
-		    bool min_found = false;
-
-		    for(int k = ((i-radius>0)? i-radius: 0); k < ((i+radius<ny)? i+radius: ny-1); k++)
-			for(int l = ((j-radius>0)? j-radius: 0); l < ((j+radius<nx)? j+radius: nx-1); l++)
+		    int r0, r1, c0, c1;
+		    fill_window(i, a + j, nx, ny, radius, r0, r1, c0, c1);
+		    
+		    int min_l = -1;
+		    int min_d = 0;
+		    
+		    if(len < radius)
+		    {
+			for(l = c0; l < c1; l++)
 			{
-			    const int q = k * nx + l;
+			    const int s = k * nx + l;
 			    
-			    if(mask2[q] != DISOCCLUSION)
+			    if(mask[s] != DISOCCLUSION || (reached[s] && ((t - reached[s]) & 1)))
 			    {
-				const int d = u[q] * u[q] + v[q] * v[q];
+				const int ds = u[s] * u[s] + v[s] * v[s];
 				
-				if(d < min_d)
+				if(ds < ((min_l < 0)? 99999.9f: min_d))
 				{
-				    min_d = d;
-				    min_u = u[q];
-				    min_v = v[q];
-				    
-				    min_found = true;
+				    min_l = l;
+				    min_d = ds;
 				}
 			    }
 			}
-
-		    if(min_found)
+		    }
+		    else
+		    {
+			for(; l < c1; l++)
+			{
+			    const int s = k * nx + l;
+			    
+			    if(mask[s] != DISOCCLUSION || (reached[s] && ((t - reached[s]) & 1)))
+			    {
+				const int ds = u[s] * u[s] + v[s] * v[s];
+				
+				if(ds < 99999.9f)
+				{
+				    while(tail > head && window_d[tail-1] > ds) tail--;
+				    window_d[tail] = ds;
+				    window_l[tail] = l;
+				    tail++;
+				}
+			    }
+			}
+			
+			while(tail > head && window_l[head] < c0) head++;
+			
+			if(tail > head)
+			{
+			    min_l = window_l[head];
+			    min_d = window_d[head];
+			}
+		    }
+		    
+		    row_k[slot + j] = k;
+		    row_q[slot + j] = (min_l >= 0)? k * nx + min_l: -1;
+		    row_d[slot + j] = min_d;
+		}
+	    }
+	    
+	    //first minimum of the rows
+	    for(int j = 0; j < len; j++)
+	    {
+		const int p = next[n + j];
+		int min_q = -1;
+		int min_d = 0;
+		
+		for(int k = k0; k < k1; k++)
+		{
+		    const int slot = (k % rows) * nx + a + j;
+		    
+		    if(row_q[slot] >= 0 && (min_q < 0 || row_d[slot] < min_d))
+		    {
+			min_q = row_q[slot];
+			min_d = row_d[slot];
+		    }
+		}
+		
+		if(min_q >= 0)
+		{
+		    if(!reached[p] || u[p] != u[min_q] || v[p] != v[min_q])
+			changed.push_back(p);
+		    
+		    if(!reached[p])
 		    {
-			u[p] = min_u;
-			v[p] = min_v;
-			mask3[p] = NO_DISOCCLUSION;
+			reached[p] = t;
+			found++;
 		    }
-		    else end = false;
+		    
+		    u[p] = u[min_q];
+		    v[p] = v[min_q];
 		}
 	    }
+	    
+	    n = m;
+	}
+	
+	//all the holes are filled, or the remaining ones are seen by no filled
+	//pixel and can not be reached (the sweep used to loop forever on them)
+	holes -= found;
+	if(holes == 0 || found == 0) break;
+	
+	//the next iteration searches the holes that see a changed value and were
+	//not filled by this one: the rows i - radius to i + radius - 1 of the changed
+	//runs are seen by row i, widened by the window; the last row and column are
+	//in no window
+	spans.clear();
+	
+	for(int n = 0; n < (int) changed.size();)
+	{
+	    const int k = changed[n] / nx;
+	    const int a = changed[n] - k * nx;
+	    
+	    int m = n + 1;
+	    while(m < (int) changed.size() && changed[m] == changed[m-1] + 1 && changed[m] - k * nx < nx) m++;
+	    
+	    const int b = std::min(a + m - n - 1, nx - 2);
+	    n = m;
+	    
+	    if(k < ny - 1 && a <= b) spans.push_back(std::make_pair(k * nx + a, k * nx + b));
+	}
+	
+	next.clear();
+	
+	for(int i = 0, lo = 0, hi = 0; lo < (int) spans.size() && i < ny; i++)
+	{
+	    while(lo < (int) spans.size() && spans[lo].first / nx < i - radius) lo++;
+	    while(hi < (int) spans.size() && spans[hi].first / nx < i + radius) hi++;
+	    
+	    if(lo == hi)
+	    {
+		//skip to the first row that sees the next run
+		if(hi < (int) spans.size()) i = std::max(i, spans[hi].first / nx - radius);
+		continue;
+	    }
+	    
+	    columns.clear();
+	    for(int n = lo; n < hi; n++)
+	    {
+		const int k = spans[n].first / nx;
+		columns.push_back(std::make_pair(std::max(spans[n].first - k * nx - radius + 1, 0), std::min(spans[n].second - k * nx + radius, nx - 1)));
+	    }
+	    std::sort(columns.begin(), columns.end());
+	    
+	    for(int n = 0, j = 0; n < (int) columns.size(); n++)
+		for(j = std::max(j, columns[n].first); j <= columns[n].second; j++)
+		{
+		    const int p = i * nx + j;
+		    
+		    if(mask[p] == DISOCCLUSION && (!reached[p] || ((t - reached[p]) & 1)))
+			next.push_back(p);
+		}
+	}
+    }
 
-	std::swap(mask2, mask3);
-
-    }while(!end);
-
-    delete []mask2;
-    delete []mask3;
+    std::free(reached);
 }
 
 
 
 /**
  * 
- *   Function to fill the empty regions with the closest min value
+ *   Function to fill the empty regions with the average of their window.
+ * 
+ *   Like restricted_minfill, every iteration reads the valid pixels and the
+ *   holes filled by the previous iteration, and fills the holes with at least
+ *   radius of them. The window sums come from masked summed-area tables of u, v
+ *   and the count of sources, built in parallel for the row strips that still
+ *   have holes to search, so every average costs O(1) whatever the radius; the
+ *   strips with a few scattered holes sum their windows directly. The new values
+ *   are written after the sweep: stereo and streetlamp pixels, which are both
+ *   filled and read, give the values from before it
  * 
  */
 void average_fill(
@@ -288,64 +601,199 @@ void average_fill(
     int    radius = 5
 )
 {
-    float *mask2 = new float[nx * ny];
-    float *mask3 = new float[nx * ny];
-
-    for(int i = 0; i < nx * ny; i++) mask2[i] = mask3[i] = mask[i];
-
-    bool end;
+    const int size = nx * ny;
+    const int strip = 64;
+    
+    //iteration that last filled every hole, 0 if none
+    int *filled = (int *) std::calloc(size, sizeof(int));
+    
+    //holes, the ones searched by the current iteration, where every strip
+    //starts in them, and the averages found
+    std::vector<int> holes, search, starts;
+    std::vector<float> avg_u, avg_v;
+    std::vector<char> found;
+    
+    for(int i = 0; i < size; i++)
+	if(mask[i] != NO_DISOCCLUSION) holes.push_back(i);
 
-    do 
+    //holes filled by the two previous iterations
+    int filled1 = 0, filled2 = 0;
+    
+    for(int t = 1; !holes.empty(); t++)
     {
-	end = true;
+	search.clear();
+	starts.clear();
+	
+	for(int n = 0; n < (int) holes.size(); n++)
+	    if(filled[holes[n]] != t - 1 || t == 1)
+	    {
+		if(search.empty() || holes[n] / nx / strip != search.back() / nx / strip)
+		    starts.push_back(search.size());
+		search.push_back(holes[n]);
+	    }
+	starts.push_back(search.size());
+	
+	avg_u.resize(search.size());
+	avg_v.resize(search.size());
+	found.resize(search.size());
 
-	for(int i = 0; i < ny; i++)
-	    for(int j = 0; j < nx; j++)
+#pragma omp parallel
+	{
+	    std::vector<double> sum_u, sum_v;
+	    std::vector<int> sum_n;
+	    
+#pragma omp for schedule(dynamic)
+	    for(int s = 0; s < (int) starts.size() - 1; s++)
 	    {
-		const int p = i * nx + j;
-		//if there is a disocclusion, then try to fill it up
-		if(mask2[p] != NO_DISOCCLUSION)
+		//rows and columns seen by the holes of the strip
+		int r0 = ny, r1 = 0, c0 = nx, c1 = 0;
+		
+		for(int n = starts[s]; n < starts[s+1]; n++)
 		{
-		    float avg_u = 0.0;
-		    float avg_v = 0.0;
-		    int n = 0;
-
-		    for(int k = ((i-radius>0)? i-radius: 0); k < ((i+radius<ny)? i+radius: ny-1); k++)
-			for(int l = ((j-radius>0)? j-radius: 0); l < ((j+radius<nx)? j+radius: nx-1); l++)
-			{
-			    const int q = k * nx + l;
-
-			    if(mask2[q] != DISOCCLUSION)
+		    const int i = search[n] / nx;
+		    int k0, k1, l0, l1;
+		    fill_window(i, search[n] - i * nx, nx, ny, radius, k0, k1, l0, l1);
+		    
+		    r0 = std::min(r0, k0);
+		    r1 = std::max(r1, k1);
+		    c0 = std::min(c0, l0);
+		    c1 = std::max(c1, l1);
+		}
+		
+		if(r1 < r0) r1 = r0;
+		if(c1 < c0) c1 = c0;
+		
+		//a few holes in a wide strip are cheaper to sum window by window
+		if((double) (starts[s+1] - starts[s]) * 4 * radius * radius < 3.0 * (r1 - r0) * (c1 - c0))
+		{
+		    for(int n = starts[s]; n < starts[s+1]; n++)
+		    {
+			const int i = search[n] / nx;
+			int k0, k1, l0, l1;
+			fill_window(i, search[n] - i * nx, nx, ny, radius, k0, k1, l0, l1);
+			
+			double window_u = 0.0, window_v = 0.0;
+			int count = 0;
+			
+			for(int k = k0; k < k1; k++)
+			    for(int l = l0; l < l1; l++)
 			    {
-				avg_u += u[q]; 
-				avg_v += v[q]; 
-				n++;
+				const int q = k * nx + l;
+				
+				if(mask[q] != DISOCCLUSION || (filled[q] == t - 1 && t > 1))
+				{
+				    window_u += u[q];
+				    window_v += v[q];
+				    count++;
+				}
 			    }
+			
+			found[n] = count >= radius;
+			if(found[n])
+			{
+			    avg_u[n] = window_u / count;
+			    avg_v[n] = window_v / count;
 			}
-
-		    if(n >= radius)
+		    }
+		    continue;
+		}
+		
+		//summed-area tables of the sources, with a row and column of zeros
+		const int w = c1 - c0 + 1;
+		const int h = r1 - r0 + 1;
+		
+		sum_u.assign(w * h, 0.0);
+		sum_v.assign(w * h, 0.0);
+		sum_n.assign(w * h, 0);
+		
+		for(int k = r0; k < r1; k++)
+		{
+		    double row_u = 0.0, row_v = 0.0;
+		    int row_n = 0;
+		    
+		    const int y = (k - r0 + 1) * w;
+		    
+		    for(int l = c0; l < c1; l++)
+		    {
+			const int q = k * nx + l;
+			
+			if(mask[q] != DISOCCLUSION || (filled[q] == t - 1 && t > 1))
+			{
+			    row_u += u[q];
+			    row_v += v[q];
+			    row_n++;
+			}
+			
+			const int x = y + l - c0 + 1;
+			
+			sum_u[x] = sum_u[x - w] + row_u;
+			sum_v[x] = sum_v[x - w] + row_v;
+			sum_n[x] = sum_n[x - w] + row_n;
+		    }
+		}
+		
+		for(int n = starts[s]; n < starts[s+1]; n++)
+		{
+		    const int i = search[n] / nx;
+		    int k0, k1, l0, l1;
+		    fill_window(i, search[n] - i * nx, nx, ny, radius, k0, k1, l0, l1);
+		    
+		    found[n] = false;
+		    if(k1 <= k0 || l1 <= l0) continue;
+		    
+		    const int x00 = (k0 - r0) * w + l0 - c0;
+		    const int x01 = (k0 - r0) * w + l1 - c0;
+		    const int x10 = (k1 - r0) * w + l0 - c0;
+		    const int x11 = (k1 - r0) * w + l1 - c0;
+		    
+		    const int count = sum_n[x11] - sum_n[x01] - sum_n[x10] + sum_n[x00];
+		    
+		    if(count >= radius)
 		    {
-			u[p] = avg_u/n;
-			v[p] = avg_v/n;
-			mask3[p] = NO_DISOCCLUSION;
+			avg_u[n] = (sum_u[x11] - sum_u[x01] - sum_u[x10] + sum_u[x00]) / count;
+			avg_v[n] = (sum_v[x11] - sum_v[x01] - sum_v[x10] + sum_v[x00]) / count;
+			found[n] = true;
 		    }
-		    else end = false;
 		}
 	    }
+	}
+	
+	int filled0 = 0;
+	
+	for(int n = 0; n < (int) search.size(); n++)
+	    if(found[n])
+	    {
+		u[search[n]] = avg_u[n];
+		v[search[n]] = avg_v[n];
+		filled[search[n]] = t;
+		filled0++;
+	    }
+	
+	//all the holes searched are filled; or the iteration filled the same
+	//holes as the one before the previous, so the next ones would repeat
+	//the last two forever (the sweep used to loop on them)
+	if(filled0 == (int) search.size() || filled0 == filled2) break;
+	
+	filled2 = filled1;
+	filled1 = filled0;
+    }
 
-	std::swap(mask2, mask3);
-
-    }while(!end);
-
-    delete []mask2;
-    delete []mask3;
+    std::free(filled);
 }
 
 
 
 /**
  *
- *   Function to fill the empty regions with the closest min value
+ *   Function to fill the empty regions with the closest min value.
+ *
+ *   Every hole marches along the opposite of its flow, bouncing back from the
+ *   image borders, until it lands on a valid pixel; it can switch once to the
+ *   direction of a larger flow met on the way. The marches do not depend on each
+ *   other, so every hole of a compact list runs its march to the end, in parallel
+ *   chunks of rows, instead of one step per sweep of the frame. A march longer
+ *   than 16 (nx + ny) steps only repeats the same rays, and a hole without flow
+ *   has no direction: both are left as they are (the sweep never ended on them)
  *
  */
 void oriented_fill(
@@ -359,96 +807,190 @@ void oriented_fill(
 )
 {
     const int size = nx * ny;
-
-    int   *index = new int[size];
+    const int max_steps = 16 * (nx + ny);
+    
+    std::vector<int> holes;
     
-    float *du  = new float[size];
-    float *dv  = new float[size];
-    float *duu = new float[size];
-    float *dvv = new float[size];
-
-    //compute filling direction
     for(int i = 0; i < size; i++)
+	if(mask[i] != NO_DISOCCLUSION) holes.push_back(i);
+
+#pragma omp parallel for schedule(dynamic, 256)
+    for(int n = 0; n < (int) holes.size(); n++)
     {
-	//in case of disocclusion
-	if(mask[i] != NO_DISOCCLUSION)
+	const int p = holes[n];
+	const int i = p / nx;
+	const int j = p - i * nx;
+	
+	//normalize direction
+	const float d = sqrt(u[p] * u[p] + v[p] * v[p]);
+	if(!(d > 0)) continue;
+	
+	float du, dv, duu, dvv;
+	duu = du = -u[p] / d;
+	dvv = dv = -v[p] / d;
+	
+	bool switched = false;
+	
+	for(int step = 0; step < max_steps; step++)
 	{
-	    //normalize direction
-	    const float d = sqrt(u[i] * u[i] + v[i] * v[i]);
-	    duu[i] = du[i] = -u[i] / d;
-	    dvv[i] = dv[i] = -v[i] / d;
-	    index[i] = -2;
+	    int k = (int)((float)i + dv + 0.5);
+	    int l = (int)((float)j + du + 0.5);
+
+	    if(k < 0 || k >= ny) {
+	      dvv = dv = -dvv;
+	      du  = duu;
+	      k = i + dv + 0.5;
+	    }
+	    if(l < 0 || l >= nx) {
+	      duu = du = -duu;
+	      dv  = dvv;
+	      l = j + du + 0.5;
+	    }
+
+	    //we fill the inverse flow
+	    const int p1 = k * nx + l;
+	    if(mask[p1] == NO_DISOCCLUSION)
+	    {
+		u_[p] = u_[p1];
+		v_[p] = v_[p1];
+		break;
+	    }
+
+	    //test the direction of both disocclusions
+	    const float d1 = sqrt(u[p1] * u[p1] + v[p1] * v[p1]);
+	    const float uv = u[p] * u[p1] + v[p] * v[p1];
+	    if(uv / (d * d1) < 0.9 && !switched) {
+		if(d1 > d) {
+		    duu = du = -u[p1] / d1;
+		    dvv = dv = -v[p1] / d1;
+		    switched = true;
+		}
+	    }
+	    du = du + duu;
+	    dv = dv + dvv;
 	}
     }
+}
 
-    bool end;
-    do
-    {	
-	end = true;
+
+
+/**
+ *
+ *   Function to fill the empty regions with the nearest valid pixel.
+ *
+ *   Exact Euclidean distance transform in two separable passes (Felzenszwalb and
+ *   Huttenlocher): the nearest valid row of every column, then the lower envelope
+ *   of the parabolas of every row, keeping the index of the pixel that gives each
+ *   distance. A run of holes is closer to the valid pixels that bound it in its
+ *   row than to anything beyond them, so the envelope of a run only spans the
+ *   run. The cost is linear in the size of the image, whatever the holes, and the
+ *   passes run in parallel over blocks of columns and over rows
+ *
+ */
+void nearest_fill(
+    float *u_,
+    float *v_,
+    float *mask,
+    int    nx,
+    int    ny
+)
+{
+    const int size = nx * ny;
+    const int block = 1024;
+
+    //nearest valid row in the column of every hole, -1 if there is none
+    int *near = new int[size];
+    std::vector<int> last(nx);
+
+#pragma omp parallel for schedule(static)
+    for(int j0 = 0; j0 < nx; j0 += block)
+    {
+	const int j1 = std::min(j0 + block, nx);
+
+	for(int j = j0; j < j1; j++) last[j] = -1;
 
 	for(int i = 0; i < ny; i++)
+	    for(int j = j0; j < j1; j++)
+	    {
+		const int p = i * nx + j;
+
+		if(mask[p] == NO_DISOCCLUSION) last[j] = i;
+		else near[p] = last[j];
+	    }
 
-	    for(int j = 0; j < nx; j++)
+	for(int j = j0; j < j1; j++) last[j] = -1;
+
+	for(int i = ny - 1; i >= 0; i--)
+	    for(int j = j0; j < j1; j++)
 	    {
 		const int p = i * nx + j;
 
-		//if there is a disocclusion and no value assigned, then try to fill it 
-		if(mask[p] != NO_DISOCCLUSION && index[p] < 0)
+		if(mask[p] == NO_DISOCCLUSION) last[j] = i;
+		else if(last[j] >= 0 && (near[p] < 0 || last[j] - i < i - near[p]))
+		    near[p] = last[j];
+	    }
+    }
+
+#pragma omp parallel
+    {
+	//columns of the parabolas of the lower envelope, their values at the
+	//origin and where they start
+	std::vector<int> site(nx), row(nx);
+	std::vector<double> height(nx), from(nx + 1);
+
+#pragma omp for schedule(static)
+	for(int i = 0; i < ny; i++)
+	    for(int h0 = 0; h0 < nx; h0++)
+	    {
+		if(mask[i * nx + h0] == NO_DISOCCLUSION) continue;
+
+		//run of holes [h0, h1], with the valid pixels around it
+		int h1 = h0;
+		while(h1 + 1 < nx && mask[i * nx + h1 + 1] != NO_DISOCCLUSION) h1++;
+
+		const int q0 = std::max(h0 - 1, 0);
+		const int q1 = std::min(h1 + 1, nx - 1);
+		int k = -1;
+
+		for(int q = q0; q <= q1; q++)
 		{
-		    int k = (int)((float)i + dv[p] + 0.5);
-		    int l = (int)((float)j + du[p] + 0.5);
+		    const int g = (mask[i * nx + q] == NO_DISOCCLUSION)? i: near[i * nx + q];
+		    if(g < 0) continue;
 
-		    if(k < 0 || k >= ny) {
-		      dvv[p] = dv[p] = -dvv[p];
-		      du[p]  = duu[p];
-		      k = i + dv[p] + 0.5;
-		    }
-		    if(l < 0 || l >= nx) {
-		      duu[p] = du[p] = -duu[p];
-		      dv[p]  = dvv[p];
-		      l = j + du[p] + 0.5;
-		    }
+		    const double fq = (double) (g - i) * (g - i) + (double) q * q;
+		    double s = -HUGE_VAL;
 
-		    const int p1 = k * nx + l;
-		    if(mask[p1] == NO_DISOCCLUSION)
-			index[p] = p1;
-		    else 
+		    while(k >= 0)
 		    {
-			end = false;
-
-			//test the direction of both disocclusions
-			const float d  = sqrt(u[p]  * u[p]  + v[p]  * v[p]);
-			const float d1 = sqrt(u[p1] * u[p1] + v[p1] * v[p1]);
-			const float uv = u[p] * u[p1] + v[p] * v[p1];
-			if(uv / (d * d1) < 0.9 && index[p] != -1) {
-			    if(d1 > d) {
-				duu[p] = du[p] = -u[p1] / d1;
-				dvv[p] = dv[p] = -v[p1] / d1;
-				index[p] = -1;
-			    }
-			}
-			du[p] = du[p] + duu[p];
-			dv[p] = dv[p] + dvv[p];
+			s = (fq - height[k]) / (2.0 * (q - site[k]));
+			if(s > from[k]) break;
+			k--;
 		    }
+
+		    k++;
+		    site[k] = q;
+		    row[k] = g;
+		    height[k] = fq;
+		    from[k] = (k == 0)? -HUGE_VAL: s;
 		}
+
+		//no valid pixel is seen by the run
+		if(k >= 0)
+		    for(int j = h0, n = 0; j <= h1; j++)
+		    {
+			while(n < k && from[n + 1] <= j) n++;
+
+			const int p  = i * nx + j;
+			const int p1 = row[n] * nx + site[n];
+			u_[p] = u_[p1];
+			v_[p] = v_[p1];
+		    }
+
+		h0 = h1 + 1;
 	    }
-    } while(!end);
-    
-    //we fill the inverse flow
-    for(int i = 0; i < size; i++)
+    }
 
-      if(mask[i] != NO_DISOCCLUSION)
-      {
-	  u_[i] = u_[index[i]];
-	  v_[i] = v_[index[i]];
-      }    
-
-    delete []index;
-    delete []du;
-    delete []dv;
-    delete []duu;
-    delete []dvv;
+    delete []near;
 }
 
-
 #endif
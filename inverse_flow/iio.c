@@ -57,6 +57,10 @@
 #  define I_CAN_HAS_MKSTEMP 1
 #endif
 
+#if defined(_GNU_SOURCE) || defined(_XOPEN_SOURCE) || defined(_POSIX_C_SOURCE)
+#  define I_CAN_HAS_FSTAT 1
+#endif
+
 //
 // enum-like, only used internally
 //
@@ -1093,31 +1097,53 @@ static void iio_general_normalize_signature(struct iio_image *x)
 // general memory and file utilities {{{1
 
 
+#ifdef I_CAN_HAS_FSTAT
+#  include <sys/stat.h>
+#endif
+
+#define IIO_LOAD_BLOCK 0x100000
+
+// Output: number of bytes left in the stream "f", or 0 when unknown (pipes)
+static size_t remaining_file_size(FILE *f)
+{
+#ifdef I_CAN_HAS_FSTAT
+	struct stat st;
+	if (fstat(fileno(f), &st) || !S_ISREG(st.st_mode))
+		return 0;
+	long pos = ftell(f);
+	if (pos < 0 || pos > st.st_size)
+		return 0;
+	return st.st_size - pos;
+#else
+	(void)f;
+	return 0;
+#endif//I_CAN_HAS_FSTAT
+}
+
 // Input: a partially read stream "f"
 // (of which "bufn" bytes are already read into "buf")
 //
 // Output: a malloc'd block with the whole file content
 //
-// Implementation: re-invent the wheel
+// Implementation: regular files are sized with fstat and read with a single
+// fread, other streams are read in large blocks
 static void *load_rest_of_file(long *on, FILE *f, void *buf, size_t bufn)
 {
-	size_t n = bufn, ntop = n + 0x3000;
-	char *t =  xmalloc(ntop);
-	if (!t) error("out of mem (%zu) while loading file", ntop);
+	size_t rest = remaining_file_size(f);
+	size_t n = bufn, ntop = bufn + (rest ? rest + 1 : IIO_LOAD_BLOCK);
+	char *t = xmalloc(ntop);
 	memcpy(t, buf, bufn);
 	while (1) {
 		if (n >= ntop) {
-			ntop = 1000 + 2*(ntop + 1);
+			ntop = 2 * ntop + IIO_LOAD_BLOCK;
 			t = xrealloc(t, ntop);
-			if (!t) error("out of mem (%zu) loading file", ntop);
-
 		}
-		int r = fgetc(f);
-		if (r == EOF)
+		size_t r = fread(t + n, 1, ntop - n, f);
+		n += r;
+		if (r == 0 || feof(f) || ferror(f))
 			break;
-		t[n] = r;//iw810
-		n += 1;
 	}
+	if (ferror(f)) error("read error while loading file");
 	*on = n;
 	return t;
 }
@@ -1364,6 +1390,13 @@ static int read_beheaded_png(struct iio_image *x,
 #ifdef I_CAN_HAS_LIBJPEG
 #  include <jpeglib.h>
 
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+#  define I_CAN_HAS_JPEG_MEM_SRC 1
+#endif
+
+static int decompress_jpeg(struct iio_image *x,
+		struct jpeg_decompress_struct *cinfo);
+
 static int read_whole_jpeg(struct iio_image *x, FILE *f)
 {
 	// allocate and initialize a JPEG decompression object
@@ -1375,6 +1408,27 @@ static int read_whole_jpeg(struct iio_image *x, FILE *f)
 	// specify the source of the compressed data
 	jpeg_stdio_src(cinfo, f);
 
+	return decompress_jpeg(x, cinfo);
+}
+
+#ifdef I_CAN_HAS_JPEG_MEM_SRC
+static int read_whole_jpeg_m(struct iio_image *x, void *data, size_t size)
+{
+	struct jpeg_decompress_struct cinfo[1];
+	struct jpeg_error_mgr jerr[1];
+	cinfo->err = jpeg_std_error(jerr);
+	jpeg_create_decompress(cinfo);
+
+	// the compressed data is read directly from memory
+	jpeg_mem_src(cinfo, data, size);
+
+	return decompress_jpeg(x, cinfo);
+}
+#endif//I_CAN_HAS_JPEG_MEM_SRC
+
+static int decompress_jpeg(struct iio_image *x,
+		struct jpeg_decompress_struct *cinfo)
+{
 	// obtain image info
 	jpeg_read_header(cinfo, 1);
 	int size[2], depth;
@@ -1422,11 +1476,16 @@ static int read_beheaded_jpeg(struct iio_image *x,
 	long filesize;
 	// TODO: if "f" is rewindable, rewind it!
 	void *filedata = load_rest_of_file(&filesize, fin, header, nheader);
+#ifdef I_CAN_HAS_JPEG_MEM_SRC
+	int r = read_whole_jpeg_m(x, filedata, filesize);
+	if (r) error("read whole jpeg returned %d", r);
+#else
 	FILE *f = iio_fmemopen(filedata, filesize);
 
 	int r = read_whole_jpeg(x, f);
 	if (r) error("read whole jpeg returned %d", r);
 	fclose(f);
+#endif//I_CAN_HAS_JPEG_MEM_SRC
 	xfree(filedata);
 
 	return 0;
@@ -1438,13 +1497,89 @@ static int read_beheaded_jpeg(struct iio_image *x,
 #ifdef I_CAN_HAS_LIBTIFF
 #  include <tiffio.h>
 
+static int read_tiff(struct iio_image *x, TIFF *tif);
+
 static int read_whole_tiff(struct iio_image *x, const char *filename)
+{
+	TIFF *tif = TIFFOpen(filename, "r");
+	if (!tif) error("could not open TIFF file \"%s\"", filename);
+	return read_tiff(x, tif);
+}
+
+// a TIFF file held in memory, read through the client procedures below
+struct tiff_memory {
+	const char *data;
+	toff_t size, pos;
+};
+
+static tsize_t tiff_memory_read(thandle_t h, tdata_t buf, tsize_t n)
+{
+	struct tiff_memory *m = (struct tiff_memory *)h;
+	if (n < 0 || m->pos >= m->size) return 0;
+	if ((toff_t)n > m->size - m->pos) n = m->size - m->pos;
+	memcpy(buf, m->data + m->pos, n);
+	m->pos += n;
+	return n;
+}
+
+static tsize_t tiff_memory_write(thandle_t h, tdata_t buf, tsize_t n)
+{
+	(void)h; (void)buf; (void)n;
+	return 0;
+}
+
+static toff_t tiff_memory_seek(thandle_t h, toff_t off, int whence)
+{
+	struct tiff_memory *m = (struct tiff_memory *)h;
+	// relative offsets may be negative, unsigned arithmetic wraps them
+	switch (whence) {
+	case SEEK_SET: m->pos = off; break;
+	case SEEK_CUR: m->pos += off; break;
+	case SEEK_END: m->pos = m->size + off; break;
+	}
+	return m->pos;
+}
+
+static int tiff_memory_close(thandle_t h)
+{
+	(void)h;
+	return 0;
+}
+
+static toff_t tiff_memory_size(thandle_t h)
+{
+	return ((struct tiff_memory *)h)->size;
+}
+
+static int tiff_memory_map(thandle_t h, tdata_t *base, toff_t *size)
+{
+	struct tiff_memory *m = (struct tiff_memory *)h;
+	*base = (tdata_t)m->data;
+	*size = m->size;
+	return 1;
+}
+
+static void tiff_memory_unmap(thandle_t h, tdata_t base, toff_t size)
+{
+	(void)h; (void)base; (void)size;
+}
+
+static int read_whole_tiff_m(struct iio_image *x, void *data, size_t size)
+{
+	struct tiff_memory m[1] = {{data, size, 0}};
+	TIFF *tif = TIFFClientOpen("memory", "r", (thandle_t)m,
+			tiff_memory_read, tiff_memory_write,
+			tiff_memory_seek, tiff_memory_close, tiff_memory_size,
+			tiff_memory_map, tiff_memory_unmap);
+	if (!tif) error("could not open TIFF data from memory");
+	return read_tiff(x, tif);
+}
+
+static int read_tiff(struct iio_image *x, TIFF *tif)
 {
 	// tries to read data in the correct format (via scanlines)
 	// if it fails, it tries to read ABGR data
 
-	TIFF *tif = TIFFOpen(filename, "r");
-	if (!tif) error("could not open TIFF file \"%s\"", filename);
 	uint32_t w, h;
 	uint16_t spp, bps, fmt;
 	int r = 0, fmt_iio=-1;
@@ -1548,10 +1683,8 @@ static int read_whole_tiff(struct iio_image *x, const char *filename)
 	return 0;
 }
 
-// Note: TIFF library only reads from a named file.  The only way to use the
-// library if you have your image in a stream, is to write the data to a
-// temporary file, and read it from there.  This can be optimized in the future
-// by recovering the original filename through hacks, in case it was not a pipe.
+// Note: when the image does not come from a named file, the TIFF library reads
+// the rest of the stream from memory through client procedures.
 static int read_beheaded_tiff(struct iio_image *x,
 		FILE *fin, char *header, int nheader)
 {
@@ -1564,15 +1697,11 @@ static int read_beheaded_tiff(struct iio_image *x,
 
 	long filesize;
 	void *filedata = load_rest_of_file(&filesize, fin, header, nheader);
-	char *filename = put_data_into_temporary_file(filedata, filesize);
-	xfree(filedata);
-	//IIO_DEBUG("tmpfile = \"%s\"\n", filename);
 
-
-	int r = read_whole_tiff(x, filename);
+	int r = read_whole_tiff_m(x, filedata, filesize);
 	if (r) error("read whole tiff returned %d", r);
 
-	delete_temporary_file(filename);
+	xfree(filedata);
 
 	return 0;
 }
@@ -2482,6 +2611,39 @@ static int read_image(struct iio_image *x, const char *fname)
 }
 
 
+// Reads an image from memory, without any temporary file: formats that can
+// only be decoded through a named file or an external program are refused
+static int read_image_m(struct iio_image *x, const void *data, size_t size)
+{
+#ifndef IIO_ABORT_ON_ERROR
+	if (setjmp(global_jump_buffer)) {
+		IIO_DEBUG("SOME ERROR HAPPENED AND WAS HANDLED\n");
+		return 1;
+	}
+#endif//IIO_ABORT_ON_ERROR
+#ifdef I_CAN_HAS_FMEMOPEN
+	// no file name, so that no reader goes back to the filesystem
+	global_variable_containing_the_name_of_the_last_opened_file = NULL;
+	FILE *f = fmemopen((void *)data, size, "r");
+	if (!f) error("fmemopen failed");
+
+	int bufmax = 0x100, nbuf;
+	char buf[bufmax];
+	int format = guess_format(f, buf, &nbuf, bufmax);
+	IIO_DEBUG("iio memory format guess: %s {%d}\n", iio_strfmt(format), nbuf);
+	if (format == IIO_FORMAT_UNRECOGNIZED || format == IIO_FORMAT_EXR)
+		error("format %s can not be decoded from memory",
+				iio_strfmt(format));
+	int r = read_beheaded_image(x, f, buf, nbuf, format);
+	fclose(f);
+	return r;
+#else
+	(void)x; (void)data; (void)size;
+	error("reading images from memory requires fmemopen");
+#endif//I_CAN_HAS_FMEMOPEN
+}
+
+
 static void iio_save_image_default(const char *filename, struct iio_image *x);
 
 
@@ -2533,6 +2695,24 @@ float *iio_read_image_float_vec(const char *fname, int *w, int *h, int *pd)
 	return x->data;
 }
 
+// API 2D
+float *iio_read_image_float_vec_m(const void *data, size_t size,
+		int *w, int *h, int *pd)
+{
+	struct iio_image x[1];
+	int r = read_image_m(x, data, size);
+	if (r) return rerror("could not read image from memory");
+	if (x->dimension != 2) {
+		x->dimension = 2;
+		//error("non 2d image");
+	}
+	*w = x->sizes[0];
+	*h = x->sizes[1];
+	*pd = x->pixel_dimension;
+	iio_convert_samples(x, IIO_TYPE_FLOAT);
+	return x->data;
+}
+
 // API 2D
 float *iio_read_image_float_rgb(const char *fname, int *w, int *h)
 {
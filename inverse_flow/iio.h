@@ -33,6 +33,10 @@ float *iio_read_image_float(const char *fname, int *w, int *h);
 float *iio_read_image_float_vec(const char *fname, int *w, int *h, int *pd);
 // x[(i + j*w)*pd + l]
 
+float *iio_read_image_float_vec_m(const void *data, size_t size,
+		int *w, int *h, int *pd);
+// same as above, from an encoded image in memory; no file is ever created
+
 float *iio_read_image_float_rgb(const char *fname, int *w, int *h);
 
 //
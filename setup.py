@@ -44,6 +44,8 @@ setup(
             sorted(glob("src/*.cpp")),
             # Example: passing in the version to the compiled code
             define_macros=[('VERSION_INFO', __version__)],
+            # DEFLATE of the flow sequences
+            libraries=["z"],
         ),
     ],
     extras_require={"test": "pytest"},
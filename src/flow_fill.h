@@ -0,0 +1,603 @@
+#ifndef FLOW_FILL_H
+#define FLOW_FILL_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// V-cycles of the harmonic fill at most, and the largest residual, in pixels, that stops them
+#ifndef HARMONIC_CYCLES
+#define HARMONIC_CYCLES 16
+#endif
+#ifndef HARMONIC_TOLERANCE
+#define HARMONIC_TOLERANCE 1e-3f
+#endif
+
+// Red-black sweeps before and after the coarse correction, and on the coarsest level
+#ifndef HARMONIC_SWEEPS
+#define HARMONIC_SWEEPS 2
+#endif
+#ifndef HARMONIC_COARSEST_SWEEPS
+#define HARMONIC_COARSEST_SWEEPS 32
+#endif
+
+
+/**
+ * Level of a push-pull pyramid: the flow averaged over the valid pixels below each
+ * pixel, and the weight of those pixels clamped to 1.
+ */
+struct fill_level {
+    std::ptrdiff_t ny = 0, nx = 0;
+    std::vector<float> u, v, w;
+};
+
+
+/**
+ * Average the 2 x 2 blocks of a ny x nx level into the next coarser level, weighted
+ * by weight(p). Pixels of zero weight are never read, so holes may hold anything.
+ * Returns whether some pixel of the coarser level still has a weight below 1.
+ */
+template <typename Weight>
+inline bool push_level(const float *u, const float *v, const Weight &weight, const std::ptrdiff_t ny,
+                       const std::ptrdiff_t nx, fill_level &coarse) {
+    coarse.ny = (ny + 1) / 2;
+    coarse.nx = (nx + 1) / 2;
+    coarse.u.resize(coarse.ny * coarse.nx);
+    coarse.v.resize(coarse.ny * coarse.nx);
+    coarse.w.resize(coarse.ny * coarse.nx);
+    bool partial = false;
+
+#pragma omp parallel for schedule(static) reduction(||:partial)
+    for (std::ptrdiff_t i = 0; i < coarse.ny; i++) {
+        // rows and columns of a block past the last one repeat it with zero weight
+        const std::ptrdiff_t r0 = 2 * i * nx, r1 = 2 * i + 1 < ny ? r0 + nx : r0;
+        const float wr = 2 * i + 1 < ny ? 1.f : 0.f;
+        for (std::ptrdiff_t j = 0; j < coarse.nx; j++) {
+            const std::ptrdiff_t c0 = 2 * j, c1 = 2 * j + 1 < nx ? c0 + 1 : c0;
+            const float wc = 2 * j + 1 < nx ? 1.f : 0.f;
+            const std::ptrdiff_t q[4] = {r0 + c0, r0 + c1, r1 + c0, r1 + c1};
+            const float s[4] = {1.f, wc, wr, wr * wc};
+            float su = 0.f, sv = 0.f, sw = 0.f;
+            for (int k = 0; k < 4; k++) {
+                const float w = s[k] * weight(q[k]);
+                su += w > 0.f ? w * u[q[k]] : 0.f;
+                sv += w > 0.f ? w * v[q[k]] : 0.f;
+                sw += w;
+            }
+            const std::ptrdiff_t p = i * coarse.nx + j;
+            coarse.u[p] = sw > 0.f ? su / sw : 0.f;
+            coarse.v[p] = sw > 0.f ? sv / sw : 0.f;
+            coarse.w[p] = std::min(sw, 1.f);
+            partial = partial || sw < 1.f;
+        }
+    }
+    return partial;
+}
+
+
+/**
+ * Bilinear sample of the coarser level at fine pixel (i, j). Fine pixel centers sit a
+ * quarter of a coarse pixel from the nearest coarse centers, so the weights are 3/4
+ * and 1/4, clamped on the borders.
+ */
+template <typename Level>
+inline void pull_sample(const Level &coarse, const std::ptrdiff_t i, const std::ptrdiff_t j, float &u, float &v) {
+    const std::ptrdiff_t i0 = (i - 1) / 2 > 0 ? (i - 1) / 2 : 0;
+    const std::ptrdiff_t i1 = std::min((i + 1) / 2, coarse.ny - 1);
+    const std::ptrdiff_t j0 = (j - 1) / 2 > 0 ? (j - 1) / 2 : 0;
+    const std::ptrdiff_t j1 = std::min((j + 1) / 2, coarse.nx - 1);
+    // weight of the second row and column
+    const float a = (i & 1) ? .25f : .75f;
+    const float b = (j & 1) ? .25f : .75f;
+    const std::ptrdiff_t p00 = i0 * coarse.nx + j0, p01 = i0 * coarse.nx + j1;
+    const std::ptrdiff_t p10 = i1 * coarse.nx + j0, p11 = i1 * coarse.nx + j1;
+    u = (1.f - a) * ((1.f - b) * coarse.u[p00] + b * coarse.u[p01])
+        + a * ((1.f - b) * coarse.u[p10] + b * coarse.u[p11]);
+    v = (1.f - a) * ((1.f - b) * coarse.v[p00] + b * coarse.v[p01])
+        + a * ((1.f - b) * coarse.v[p10] + b * coarse.v[p11]);
+}
+
+
+/**
+ * Fill the holes of a planar ny x nx flow (u, v) with push-pull: the valid pixels,
+ * those with mask[p] == valid, are averaged into a pyramid of halved levels, then
+ * every level is blended, in proportion to its missing weight, with the bilinear
+ * upsampling of the coarser one. Valid pixels are kept and holes take the value of
+ * the first level where their neighbourhood has some weight.
+ *
+ * Levels stop as soon as one has no partial weight, so the cost is at most about
+ * 4/3 of a pass over the flow, whatever the size of the holes. Without any valid
+ * pixel the holes are set to zero. Returns the number of levels built.
+ */
+template <typename T>
+inline int push_pull_fill(float *u, float *v, const T *mask, const T valid,
+                          const std::ptrdiff_t ny, const std::ptrdiff_t nx) {
+    if (std::find_if(mask, mask + ny * nx, [valid](const T m) { return m != valid; }) == mask + ny * nx)
+        return 0;
+
+    // push
+    std::vector<fill_level> levels(1);
+    bool partial = push_level(u, v, [mask, valid](const std::ptrdiff_t p) { return mask[p] == valid ? 1.f : 0.f; },
+                              ny, nx, levels[0]);
+    while (partial && (levels.back().ny > 1 || levels.back().nx > 1)) {
+        const fill_level &fine = levels.back();
+        fill_level coarse;
+        partial = push_level(fine.u.data(), fine.v.data(), [&fine](const std::ptrdiff_t p) { return fine.w[p]; },
+                             fine.ny, fine.nx, coarse);
+        levels.push_back(std::move(coarse));
+    }
+
+    // pull
+    for (std::size_t l = levels.size() - 1; l-- > 0;) {
+        fill_level &fine = levels[l];
+        const fill_level &coarse = levels[l + 1];
+#pragma omp parallel for schedule(static)
+        for (std::ptrdiff_t i = 0; i < fine.ny; i++) {
+            for (std::ptrdiff_t j = 0; j < fine.nx; j++) {
+                const std::ptrdiff_t p = i * fine.nx + j;
+                const float w = fine.w[p];
+                if (w >= 1.f)
+                    continue;
+                float cu, cv;
+                pull_sample(coarse, i, j, cu, cv);
+                fine.u[p] = w * fine.u[p] + (1.f - w) * cu;
+                fine.v[p] = w * fine.v[p] + (1.f - w) * cv;
+            }
+        }
+    }
+#pragma omp parallel for schedule(static)
+    for (std::ptrdiff_t i = 0; i < ny; i++) {
+        for (std::ptrdiff_t j = 0; j < nx; j++) {
+            if (mask[i * nx + j] != valid)
+                pull_sample(levels[0], i, j, u[i * nx + j], v[i * nx + j]);
+        }
+    }
+
+    return int(levels.size());
+}
+
+
+/**
+ * Run [j0, j1) of unknown pixels of row i.
+ */
+struct hole_run {
+    std::ptrdiff_t i, j0, j1;
+};
+
+
+struct free_deleter {
+    void operator()(void *p) const { std::free(p); }
+};
+
+
+/**
+ * Zeroed array of n elements. Pages of calloc are only mapped when touched, so the
+ * levels of small holes cost little, whatever the size of the frame.
+ */
+template <typename T>
+inline std::unique_ptr<T[], free_deleter> zeroed_array(const std::ptrdiff_t n) {
+    T *data = static_cast<T *>(std::calloc(std::size_t(n), sizeof(T)));
+    if (!data)
+        throw std::bad_alloc();
+    return std::unique_ptr<T[], free_deleter>(data);
+}
+
+
+/**
+ * Level of the harmonic multigrid. The finest level solves for the flow itself and
+ * the coarser ones for corrections of the finer level, with a right hand side.
+ * Pixels that are not holes are fixed: the valid flow on the finest level, zero
+ * corrections on the others. A coarse pixel is a hole when all its children are,
+ * so every coarse region of holes keeps a fixed boundary.
+ */
+struct harmonic_level {
+    std::ptrdiff_t ny = 0, nx = 0;
+    float *u = nullptr, *v = nullptr;
+    float *ru = nullptr, *rv = nullptr;  // right hand side, null on the finest level
+    std::vector<hole_run> runs;
+    std::vector<std::size_t> first_run;  // of every row, and one past the last run
+    std::ptrdiff_t holes = 0;
+    // u, v, ru and rv, and the hole flags of the coarser levels
+    std::unique_ptr<float[], free_deleter> storage;
+    std::unique_ptr<uint8_t[], free_deleter> hole;
+};
+
+
+/**
+ * Add the run [j0, j1) of row i to a level, whose runs are built in raster order.
+ */
+inline void add_run(harmonic_level &level, const std::ptrdiff_t i, const std::ptrdiff_t j0, const std::ptrdiff_t j1) {
+    while (std::ptrdiff_t(level.first_run.size()) <= i)
+        level.first_run.push_back(level.runs.size());
+    level.runs.push_back({i, j0, j1});
+    level.holes += j1 - j0;
+}
+
+
+/**
+ * Close the runs of a level.
+ */
+inline void end_runs(harmonic_level &level) {
+    level.first_run.resize(level.ny + 1, level.runs.size());
+}
+
+
+/**
+ * Coarser level of a harmonic level: its holes are the pixels whose children are all
+ * holes, the intersection of the runs of each pair of rows.
+ */
+inline harmonic_level coarsen(const harmonic_level &fine) {
+    harmonic_level coarse;
+    coarse.ny = (fine.ny + 1) / 2;
+    coarse.nx = (fine.nx + 1) / 2;
+    for (std::ptrdiff_t i = 0; i < coarse.ny; i++) {
+        const std::ptrdiff_t y1 = std::min(2 * i + 1, fine.ny - 1);
+        std::size_t a = fine.first_run[2 * i], b = fine.first_run[y1];
+        const std::size_t a1 = fine.first_run[2 * i + 1], b1 = fine.first_run[y1 + 1];
+        while (a < a1 && b < b1) {
+            const std::ptrdiff_t x0 = std::max(fine.runs[a].j0, fine.runs[b].j0);
+            const std::ptrdiff_t x1 = std::min(fine.runs[a].j1, fine.runs[b].j1);
+            // pixels 2j and 2j + 1 are both in [x0, x1), the last odd column has only one
+            const std::ptrdiff_t j0 = (x0 + 1) / 2, j1 = x1 == fine.nx ? coarse.nx : x1 / 2;
+            if (j0 < j1)
+                add_run(coarse, i, j0, j1);
+            if (fine.runs[a].j1 < fine.runs[b].j1)
+                a++;
+            else
+                b++;
+        }
+    }
+    end_runs(coarse);
+
+    const std::ptrdiff_t size = coarse.ny * coarse.nx;
+    coarse.storage = zeroed_array<float>(4 * size);
+    coarse.u = coarse.storage.get();
+    coarse.v = coarse.u + size;
+    coarse.ru = coarse.v + size;
+    coarse.rv = coarse.ru + size;
+    coarse.hole = zeroed_array<uint8_t>(size);
+    for (const hole_run &run : coarse.runs)
+        std::fill(coarse.hole.get() + run.i * coarse.nx + run.j0, coarse.hole.get() + run.i * coarse.nx + run.j1,
+                  uint8_t(1));
+    return coarse;
+}
+
+
+/**
+ * Sum of the neighbours of pixel (i, j) plus its right hand side, and their count
+ * n. Borders are mirrored: the neighbours outside the frame are left out.
+ */
+inline void harmonic_sum(const harmonic_level &level, const std::ptrdiff_t i, const std::ptrdiff_t j,
+                         float &su, float &sv, float &n) {
+    const std::ptrdiff_t nx = level.nx, p = i * nx + j;
+    su = level.ru ? level.ru[p] : 0.f;
+    sv = level.rv ? level.rv[p] : 0.f;
+    if (i > 0 && i + 1 < level.ny && j > 0 && j + 1 < nx) {
+        su += level.u[p - nx] + level.u[p + nx] + level.u[p - 1] + level.u[p + 1];
+        sv += level.v[p - nx] + level.v[p + nx] + level.v[p - 1] + level.v[p + 1];
+        n = 4.f;
+        return;
+    }
+    n = 0.f;
+    const std::ptrdiff_t neighbours[4] = {i > 0 ? p - nx : -1, i + 1 < level.ny ? p + nx : -1,
+                                          j > 0 ? p - 1 : -1, j + 1 < nx ? p + 1 : -1};
+    for (const std::ptrdiff_t q : neighbours) {
+        if (q >= 0) {
+            su += level.u[q];
+            sv += level.v[q];
+            n++;
+        }
+    }
+}
+
+
+/**
+ * Gauss-Seidel update of the pixels j0, j0 + 2, ... below j1 of a row that has
+ * four neighbours, with the right hand side r when it is not null. Both loops
+ * read one color and write the other, and vectorize.
+ */
+inline void harmonic_row(float *x, const std::ptrdiff_t nx, const float *r, const std::ptrdiff_t j0,
+                         const std::ptrdiff_t j1) {
+    const float *up = x - nx, *down = x + nx;
+    if (r)
+        for (std::ptrdiff_t j = j0; j < j1; j += 2)
+            x[j] = .25f * (r[j] + up[j] + down[j] + x[j - 1] + x[j + 1]);
+    else
+        for (std::ptrdiff_t j = j0; j < j1; j += 2)
+            x[j] = .25f * (up[j] + down[j] + x[j - 1] + x[j + 1]);
+}
+
+
+/**
+ * Gauss-Seidel sweep over the holes of one color, (i + j) % 2 == color. Holes of a
+ * color only read the other one, so the runs are updated in parallel. Inside the
+ * frame the update has no branch, which lets the compiler vectorize it.
+ */
+inline void harmonic_sweep(harmonic_level &level, const int color) {
+    const std::ptrdiff_t ny = level.ny, nx = level.nx;
+    float *u = level.u, *v = level.v;
+    const float *ru = level.ru, *rv = level.rv;
+
+#pragma omp parallel for schedule(dynamic, 64)
+    for (std::ptrdiff_t k = 0; k < std::ptrdiff_t(level.runs.size()); k++) {
+        const hole_run run = level.runs[k];
+        const std::ptrdiff_t i = run.i;
+        std::ptrdiff_t j = run.j0 + ((i + run.j0 + color) & 1);
+        for (; j < run.j1; j += 2) {
+            // long runs inside the frame
+            const std::ptrdiff_t j1 = std::min(run.j1, nx - 1);
+            if (i > 0 && i + 1 < ny && j > 0 && j1 - j > 16) {
+                harmonic_row(u + i * nx, nx, ru ? ru + i * nx : nullptr, j, j1);
+                harmonic_row(v + i * nx, nx, rv ? rv + i * nx : nullptr, j, j1);
+                j += (j1 - 1 - j) / 2 * 2;
+                continue;
+            }
+            float su, sv, n;
+            harmonic_sum(level, i, j, su, sv, n);
+            if (n > 0.f) {
+                u[i * nx + j] = su / n;
+                v[i * nx + j] = sv / n;
+            }
+        }
+    }
+}
+
+
+/**
+ * Restrict the residuals of the holes of a level into the right hand side of the
+ * coarser one, summed over the 2 x 2 children, and zero the corrections of the
+ * coarser holes. Levels one pixel thick only have 2 children, counted twice.
+ * Returns the largest residual.
+ */
+inline float harmonic_restrict(const harmonic_level &fine, harmonic_level &coarse) {
+    const float thin = (fine.ny == 1 ? 2.f : 1.f) * (fine.nx == 1 ? 2.f : 1.f);
+    float largest = 0.f;
+
+#pragma omp parallel for schedule(dynamic, 16) reduction(max:largest)
+    for (std::ptrdiff_t i = 0; i < coarse.ny; i++) {
+        for (std::size_t k = coarse.first_run[i]; k < coarse.first_run[i + 1]; k++) {
+            const std::ptrdiff_t p0 = i * coarse.nx + coarse.runs[k].j0, p1 = i * coarse.nx + coarse.runs[k].j1;
+            for (float *x : {coarse.u, coarse.v, coarse.ru, coarse.rv})
+                std::fill(x + p0, x + p1, 0.f);
+        }
+        const std::size_t k1 = fine.first_run[std::min(2 * i + 2, fine.ny)];
+        for (std::size_t k = fine.first_run[2 * i]; k < k1; k++) {
+            const hole_run run = fine.runs[k];
+            for (std::ptrdiff_t j = run.j0; j < run.j1; j++) {
+                float su, sv, n;
+                harmonic_sum(fine, run.i, j, su, sv, n);
+                su -= n * fine.u[run.i * fine.nx + j];
+                sv -= n * fine.v[run.i * fine.nx + j];
+                largest = std::max(largest, std::max(std::fabs(su), std::fabs(sv)));
+                const std::ptrdiff_t p = i * coarse.nx + j / 2;
+                if (coarse.hole[p]) {
+                    coarse.ru[p] += thin * su;
+                    coarse.rv[p] += thin * sv;
+                }
+            }
+        }
+    }
+    return largest;
+}
+
+
+/**
+ * Largest residual of the holes of a level.
+ */
+inline float harmonic_residual(const harmonic_level &level) {
+    float largest = 0.f;
+
+#pragma omp parallel for schedule(dynamic, 64) reduction(max:largest)
+    for (std::ptrdiff_t k = 0; k < std::ptrdiff_t(level.runs.size()); k++) {
+        const hole_run run = level.runs[k];
+        for (std::ptrdiff_t j = run.j0; j < run.j1; j++) {
+            float su, sv, n;
+            harmonic_sum(level, run.i, j, su, sv, n);
+            su -= n * level.u[run.i * level.nx + j];
+            sv -= n * level.v[run.i * level.nx + j];
+            largest = std::max(largest, std::max(std::fabs(su), std::fabs(sv)));
+        }
+    }
+    return largest;
+}
+
+
+/**
+ * Add the bilinear upsampling of the coarser corrections to the holes of a level.
+ */
+inline void harmonic_prolong(harmonic_level &fine, const harmonic_level &coarse) {
+#pragma omp parallel for schedule(dynamic, 64)
+    for (std::ptrdiff_t k = 0; k < std::ptrdiff_t(fine.runs.size()); k++) {
+        const hole_run run = fine.runs[k];
+        for (std::ptrdiff_t j = run.j0; j < run.j1; j++) {
+            float cu, cv;
+            pull_sample(coarse, run.i, j, cu, cv);
+            fine.u[run.i * fine.nx + j] += cu;
+            fine.v[run.i * fine.nx + j] += cv;
+        }
+    }
+}
+
+
+/**
+ * V-cycle from level l. Returns the largest residual of the level before its coarse
+ * correction, or after the sweeps on the coarsest level.
+ */
+inline float harmonic_cycle(std::vector<harmonic_level> &levels, const std::size_t l) {
+    harmonic_level &level = levels[l];
+    if (level.holes == 0)
+        return 0.f;
+    if (l + 1 == levels.size()) {
+        for (int s = 0; s < HARMONIC_COARSEST_SWEEPS; s++) {
+            harmonic_sweep(level, 0);
+            harmonic_sweep(level, 1);
+        }
+        return harmonic_residual(level);
+    }
+    for (int s = 0; s < HARMONIC_SWEEPS; s++) {
+        harmonic_sweep(level, 0);
+        harmonic_sweep(level, 1);
+    }
+    const float largest = harmonic_restrict(level, levels[l + 1]);
+    // the last cycle only checks the residual of the finest level
+    if (l == 0 && largest < HARMONIC_TOLERANCE)
+        return largest;
+    harmonic_cycle(levels, l + 1);
+    harmonic_prolong(level, levels[l + 1]);
+    for (int s = 0; s < HARMONIC_SWEEPS; s++) {
+        harmonic_sweep(level, 1);
+        harmonic_sweep(level, 0);
+    }
+    return largest;
+}
+
+
+/**
+ * Fill the holes of a planar ny x nx flow (u, v), those with mask[p] != valid, with
+ * the harmonic interpolant of the valid pixels around them: the solution of the
+ * Laplace equation on the holes, with the valid pixels as Dirichlet boundary and
+ * mirrored frame borders.
+ *
+ * The push-pull fill gives the first guess, then multigrid V-cycles of red-black
+ * Gauss-Seidel sweeps run until the largest residual is below HARMONIC_TOLERANCE.
+ * The sweeps only visit the holes of every level, so their cost follows the size of
+ * the holes rather than of the frame.
+ * Returns the number of V-cycles.
+ */
+template <typename T>
+inline int harmonic_fill(float *u, float *v, const T *mask, const T valid,
+                         const std::ptrdiff_t ny, const std::ptrdiff_t nx) {
+    if (push_pull_fill(u, v, mask, valid, ny, nx) == 0 || ny * nx == 1)
+        return 0;
+
+    std::vector<harmonic_level> levels(1);
+    levels[0].ny = ny;
+    levels[0].nx = nx;
+    levels[0].u = u;
+    levels[0].v = v;
+    for (std::ptrdiff_t i = 0; i < ny; i++) {
+        const T *row = mask + i * nx;
+        for (std::ptrdiff_t j = 0; j < nx; j++) {
+            if (row[j] == valid)
+                continue;
+            const std::ptrdiff_t j0 = j;
+            while (j < nx && row[j] != valid)
+                j++;
+            add_run(levels[0], i, j0, j);
+        }
+    }
+    end_runs(levels[0]);
+
+    while (levels.back().holes > 16)
+        levels.push_back(coarsen(levels.back()));
+
+    int cycles = 0;
+    while (cycles < HARMONIC_CYCLES) {
+        cycles++;
+        if (harmonic_cycle(levels, 0) < HARMONIC_TOLERANCE)
+            break;
+    }
+    return cycles;
+}
+
+
+/**
+ * Call visit(q) for every 8 neighbour q of pixel p inside the ny x nx frame.
+ */
+template <typename Visit>
+inline void visit_neighbours(const std::ptrdiff_t p, const std::ptrdiff_t ny, const std::ptrdiff_t nx,
+                             const Visit &visit) {
+    const std::ptrdiff_t i = p / nx, j = p % nx;
+    for (std::ptrdiff_t y = std::max<std::ptrdiff_t>(i - 1, 0); y <= std::min(i + 1, ny - 1); y++)
+        for (std::ptrdiff_t x = std::max<std::ptrdiff_t>(j - 1, 0); x <= std::min(j + 1, nx - 1); x++)
+            if (y != i || x != j)
+                visit(y * nx + x);
+}
+
+
+/**
+ * Fill the holes of a planar ny x nx flow (u, v) ring by ring from the valid pixels,
+ * those with mask[p] == valid. Every ring takes the average of the 8 neighbours that
+ * are valid or filled by the previous rings, so ring d holds the holes at chessboard
+ * distance d, and filled pixels are marked valid in the mask.
+ *
+ * The fill stops after max_distance rings and once budget_ns nanoseconds have passed,
+ * checked before every ring; zero leaves either bound out. The holes left are still
+ * flagged in the mask. The cost follows the number of filled pixels, after one scan
+ * of the mask. Returns the number of rings.
+ */
+template <typename T>
+inline int bounded_fill(float *u, float *v, T *mask, const T valid, const std::ptrdiff_t ny, const std::ptrdiff_t nx,
+                        const int max_distance, const int64_t budget_ns) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto queued = zeroed_array<uint8_t>(ny * nx);
+    std::vector<std::ptrdiff_t> ring, next;
+    std::vector<float> ring_u, ring_v;
+
+    // holes next to a valid pixel, from the valid pixels of each column of three rows
+    std::vector<uint8_t> column(nx + 2);
+    for (std::ptrdiff_t i = 0; i < ny; i++) {
+        const T *row = mask + i * nx;
+        const T *above = i > 0 ? row - nx : row;
+        const T *below = i + 1 < ny ? row + nx : row;
+        for (std::ptrdiff_t j = 0; j < nx; j++)
+            column[j + 1] = (above[j] == valid) | (row[j] == valid) | (below[j] == valid);
+        for (std::ptrdiff_t j = 0; j < nx; j++) {
+            if (row[j] != valid && (column[j] | column[j + 1] | column[j + 2])) {
+                queued[i * nx + j] = 1;
+                ring.push_back(i * nx + j);
+            }
+        }
+    }
+
+    int rings = 0;
+    while (!ring.empty() && (max_distance <= 0 || rings < max_distance)) {
+        if (budget_ns > 0 && std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now() - start).count() >= budget_ns)
+            break;
+
+        // the whole ring reads the previous ones before any of it is written
+        ring_u.resize(ring.size());
+        ring_v.resize(ring.size());
+#pragma omp parallel for schedule(static)
+        for (std::ptrdiff_t k = 0; k < std::ptrdiff_t(ring.size()); k++) {
+            float su = 0.f, sv = 0.f, n = 0.f;
+            visit_neighbours(ring[k], ny, nx, [&](const std::ptrdiff_t q) {
+                if (mask[q] == valid) {
+                    su += u[q];
+                    sv += v[q];
+                    n++;
+                }
+            });
+            ring_u[k] = su / n;
+            ring_v[k] = sv / n;
+        }
+        for (std::size_t k = 0; k < ring.size(); k++) {
+            u[ring[k]] = ring_u[k];
+            v[ring[k]] = ring_v[k];
+            mask[ring[k]] = valid;
+        }
+        rings++;
+
+        next.clear();
+        for (const std::ptrdiff_t p : ring) {
+            visit_neighbours(p, ny, nx, [&](const std::ptrdiff_t q) {
+                if (mask[q] != valid && !queued[q]) {
+                    queued[q] = 1;
+                    next.push_back(q);
+                }
+            });
+        }
+        ring.swap(next);
+    }
+    return rings;
+}
+
+#endif // FLOW_FILL_H
@@ -0,0 +1,419 @@
+#ifndef FLOW_IO_H
+#define FLOW_IO_H
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FLOW_IO_MMAP 1
+#endif
+
+#include "inverse_optical_flow.h"
+
+/**
+ * Where the samples of an encoded flow are. The horizontal component of pixel
+ * (y, x) is at byte offset + y * sy + x * sx, and the vertical one sc bytes after
+ * it. Strides are in bytes and sy is negative for images stored bottom-up.
+ */
+struct flow_layout {
+    std::ptrdiff_t ny, nx;
+    std::ptrdiff_t offset;
+    std::ptrdiff_t sc, sy, sx;
+    bool swap;  // samples have the opposite endianness of the host
+};
+
+
+inline bool little_endian_host() {
+    const uint16_t one = 1;
+    uint8_t first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+
+// 4-byte sample at p, byte swapped if needed
+template <typename T>
+inline T load_4bytes(const uint8_t *p, const bool swap) {
+    const uint8_t b[4] = {p[swap ? 3 : 0], p[swap ? 2 : 1], p[swap ? 1 : 2], p[swap ? 0 : 3]};
+    T value;
+    std::memcpy(&value, b, 4);
+    return value;
+}
+
+inline float load_sample(const uint8_t *p, const bool swap) { return load_4bytes<float>(p, swap); }
+inline int32_t load_int32(const uint8_t *p, const bool swap) { return load_4bytes<int32_t>(p, swap); }
+
+
+inline void check_flow_size(const std::ptrdiff_t ny, const std::ptrdiff_t nx, const std::ptrdiff_t data_bytes,
+                            const std::ptrdiff_t pixel_bytes) {
+    if (ny <= 0 || nx <= 0 || ny > (1 << 20) || nx > (1 << 20))
+        throw std::runtime_error("Invalid flow size " + std::to_string(nx) + " x " + std::to_string(ny));
+    if (data_bytes < ny * nx * pixel_bytes)
+        throw std::runtime_error("Truncated flow data");
+}
+
+
+/**
+ * Middlebury .flo: "PIEH", width and height as little endian int32, then the
+ * interleaved little endian float samples, row by row.
+ */
+inline flow_layout parse_flo(const uint8_t *data, const std::size_t size) {
+    if (size < 12 || std::memcmp(data, "PIEH", 4) != 0)
+        throw std::runtime_error("Not a .flo file");
+    const bool swap = !little_endian_host();
+    const std::ptrdiff_t nx = load_int32(data + 4, swap);
+    const std::ptrdiff_t ny = load_int32(data + 8, swap);
+    check_flow_size(ny, nx, std::ptrdiff_t(size) - 12, 8);
+    return {ny, nx, 12, 4, 8 * nx, 8, swap};
+}
+
+
+/**
+ * PFM: "PF" (three channels) or "Pf" (one channel), width, height and scale in
+ * text, then the float samples. Rows are stored bottom-up and a negative scale
+ * means little endian samples. Flows need at least two channels, the third one of
+ * "PF" files is ignored.
+ */
+inline flow_layout parse_pfm(const uint8_t *data, const std::size_t size) {
+    if (size < 3 || data[0] != 'P' || (data[1] != 'F' && data[1] != 'f'))
+        throw std::runtime_error("Not a PFM file");
+    if (data[1] == 'f')
+        throw std::runtime_error("PFM file has a single channel, a flow needs two");
+
+    // three numbers, each preceded by white space, and a single white space character
+    std::size_t pos = 2;
+    std::string fields[3];
+    for (auto & field : fields) {
+        if (pos >= size || !std::isspace(data[pos]))
+            throw std::runtime_error("Invalid PFM header");
+        while (pos < size && std::isspace(data[pos]))
+            pos++;
+        while (pos < size && !std::isspace(data[pos]) && field.size() < 32)
+            field += char(data[pos++]);
+    }
+    if (pos >= size || !std::isspace(data[pos]))
+        throw std::runtime_error("Invalid PFM header");
+    pos++;
+
+    const std::ptrdiff_t nx = std::atol(fields[0].c_str());
+    const std::ptrdiff_t ny = std::atol(fields[1].c_str());
+    const double scale = std::atof(fields[2].c_str());
+    if (scale == 0)
+        throw std::runtime_error("Invalid PFM scale");
+    check_flow_size(ny, nx, std::ptrdiff_t(size - pos), 12);
+
+    const bool swap = (scale < 0) != little_endian_host();
+    return {ny, nx, std::ptrdiff_t(pos) + (ny - 1) * 12 * nx, 4, -12 * nx, 12, swap};
+}
+
+
+// Value of a key of the header dictionary of a .npy file, as written by numpy
+inline std::string npy_header_value(const std::string & header, const std::string & key) {
+    const auto start = header.find("'" + key + "'");
+    if (start == std::string::npos)
+        throw std::runtime_error("Invalid .npy header, no " + key);
+    auto begin = header.find(':', start) + 1;
+    while (begin < header.size() && header[begin] == ' ')
+        begin++;
+    const auto end = header.find(header[begin] == '(' ? ")" : ",", begin);
+    if (end == std::string::npos)
+        throw std::runtime_error("Invalid .npy header, no " + key);
+    return header.substr(begin, end - begin + (header[begin] == '('));
+}
+
+
+/**
+ * NumPy .npy: magic, version, header length and a dictionary giving the dtype,
+ * order and shape of the array. Flows are float32 arrays of shape (ny, nx, 2) or
+ * (2, ny, nx), in C order.
+ */
+inline flow_layout parse_npy(const uint8_t *data, const std::size_t size) {
+    if (size < 10 || std::memcmp(data, "\x93NUMPY", 6) != 0)
+        throw std::runtime_error("Not a .npy file");
+    const bool version_1 = data[6] == 1;
+    const std::size_t length_bytes = version_1 ? 2 : 4;
+    if (size < 8 + length_bytes)
+        throw std::runtime_error("Truncated .npy header");
+    std::size_t header_length = data[8] | data[9] << 8;
+    if (!version_1)
+        header_length |= std::size_t(data[10]) << 16 | std::size_t(data[11]) << 24;
+    const std::size_t start = 8 + length_bytes;
+    if (size < start + header_length)
+        throw std::runtime_error("Truncated .npy header");
+    const std::string header(reinterpret_cast<const char *>(data + start), header_length);
+
+    const std::string descr = npy_header_value(header, "descr");
+    if (descr != "'<f4'" && descr != "'>f4'")
+        throw std::runtime_error("Flow .npy must hold float32 samples, not " + descr);
+    if (npy_header_value(header, "fortran_order") != "False")
+        throw std::runtime_error("Flow .npy must be in C order");
+
+    long shape[3];
+    if (std::sscanf(npy_header_value(header, "shape").c_str(), "(%ld, %ld, %ld)", &shape[0], &shape[1], &shape[2]) != 3)
+        throw std::runtime_error("Flow .npy must have 3 dimensions");
+
+    const bool swap = (descr[1] == '<') != little_endian_host();
+    const auto offset = std::ptrdiff_t(start + header_length);
+    const auto data_bytes = std::ptrdiff_t(size) - offset;
+    if (shape[2] == 2) {
+        check_flow_size(shape[0], shape[1], data_bytes, 8);
+        return {shape[0], shape[1], offset, 4, 8 * shape[1], 8, swap};
+    }
+    if (shape[0] == 2) {
+        check_flow_size(shape[1], shape[2], data_bytes, 8);
+        return {shape[1], shape[2], offset, 4 * shape[1] * shape[2], 4 * shape[2], 4, swap};
+    }
+    throw std::runtime_error("Flow .npy must have shape (ny, nx, 2) or (2, ny, nx)");
+}
+
+
+inline bool is_flo(const uint8_t *data, const std::size_t size) {
+    return size >= 4 && std::memcmp(data, "PIEH", 4) == 0;
+}
+
+inline bool is_pfm(const uint8_t *data, const std::size_t size) {
+    return size >= 2 && data[0] == 'P' && (data[1] == 'F' || data[1] == 'f');
+}
+
+inline bool is_npy(const uint8_t *data, const std::size_t size) {
+    return size >= 6 && std::memcmp(data, "\x93NUMPY", 6) == 0;
+}
+
+inline bool is_flow(const uint8_t *data, const std::size_t size) {
+    return is_flo(data, size) || is_pfm(data, size) || is_npy(data, size);
+}
+
+
+/**
+ * Layout of a .flo, PFM or .npy flow held in memory; throws when the format is
+ * not recognized or the data is truncated.
+ */
+inline flow_layout parse_flow(const uint8_t *data, const std::size_t size) {
+    if (is_flo(data, size))
+        return parse_flo(data, size);
+    if (is_pfm(data, size))
+        return parse_pfm(data, size);
+    if (is_npy(data, size))
+        return parse_npy(data, size);
+    throw std::runtime_error("Unknown flow format, expected .flo, PFM or .npy");
+}
+
+
+/**
+ * Decode the samples into planar u and v buffers of layout.ny * layout.nx floats.
+ */
+inline void decode_flow(const uint8_t *data, const flow_layout & layout, float *u, float *v) {
+    for (std::ptrdiff_t y = 0; y < layout.ny; y++) {
+        const uint8_t *row = data + layout.offset + y * layout.sy;
+        float *u_row = u + y * layout.nx;
+        float *v_row = v + y * layout.nx;
+        if (!layout.swap && layout.sx == 4) {
+            std::memcpy(u_row, row, 4 * layout.nx);
+            std::memcpy(v_row, row + layout.sc, 4 * layout.nx);
+            continue;
+        }
+        if (!layout.swap && layout.sx == 8 && layout.sc == 4) {
+            for (std::ptrdiff_t x = 0; x < layout.nx; x++) {
+                float uv[2];
+                std::memcpy(uv, row + 8 * x, 8);
+                u_row[x] = uv[0];
+                v_row[x] = uv[1];
+            }
+            continue;
+        }
+        for (std::ptrdiff_t x = 0; x < layout.nx; x++) {
+            u_row[x] = load_sample(row + x * layout.sx, layout.swap);
+            v_row[x] = load_sample(row + x * layout.sx + layout.sc, layout.swap);
+        }
+    }
+}
+
+
+/**
+ * Whether the kernels can read the samples in place: native endianness and
+ * samples aligned to floats.
+ */
+inline bool viewable_flow(const uint8_t *data, const flow_layout & layout) {
+    const auto f = std::ptrdiff_t(sizeof(float));
+    return !layout.swap && reinterpret_cast<std::uintptr_t>(data + layout.offset) % alignof(float) == 0 &&
+           layout.sc % f == 0 && layout.sy % f == 0 && layout.sx % f == 0;
+}
+
+
+// Strided view of the samples, only valid when viewable_flow() holds
+inline flow_view view_flow(const uint8_t *data, const flow_layout & layout) {
+    const auto f = std::ptrdiff_t(sizeof(float));
+    return {reinterpret_cast<const float *>(data + layout.offset), layout.ny, layout.nx,
+            layout.sc / f, layout.sy / f, layout.sx / f};
+}
+
+
+// Extension of a path in lower case, without the dot
+inline std::string path_extension(const std::string & path) {
+    const auto dot = path.rfind('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
+        return "";
+    std::string extension = path.substr(dot + 1);
+    for (auto & c : extension)
+        c = char(std::tolower(static_cast<unsigned char>(c)));
+    return extension;
+}
+
+// Whether write_flow() knows the format of a path
+inline bool writable_flow(const std::string & path) {
+    const std::string extension = path_extension(path);
+    return extension == "flo" || extension == "pfm";
+}
+
+
+/**
+ * Write the pixels of planar u and v buffers interleaved, with zeros as the
+ * remaining channels, from the top or the bottom row. Pixels are interleaved a
+ * block at a time, so the frame is never copied as a whole.
+ */
+inline void write_flow_samples(std::FILE *f, const float *u, const float *v, const std::ptrdiff_t nx,
+                               const std::ptrdiff_t ny, const int channels, const bool bottom_up, const bool swap) {
+    const std::ptrdiff_t block_pixels = (1 << 18) / channels;
+    std::vector<float> block(std::size_t(block_pixels * channels), 0.0f);
+    std::ptrdiff_t n = 0;
+
+    auto flush = [&]() {
+        if (swap)
+            for (std::ptrdiff_t i = 0; i < n * channels; i++)
+                block[i] = load_sample(reinterpret_cast<const uint8_t *>(&block[i]), true);
+        if (std::fwrite(block.data(), sizeof(float) * channels, std::size_t(n), f) != std::size_t(n))
+            throw std::runtime_error("Can not write the flow samples");
+        n = 0;
+    };
+
+    for (std::ptrdiff_t row = 0; row < ny; row++) {
+        const std::ptrdiff_t y = bottom_up ? ny - 1 - row : row;
+        for (std::ptrdiff_t x = 0; x < nx; x++) {
+            block[n * channels] = u[y * nx + x];
+            block[n * channels + 1] = v[y * nx + x];
+            if (++n == block_pixels)
+                flush();
+        }
+    }
+    if (n > 0)
+        flush();
+}
+
+
+/**
+ * Write planar u and v buffers of ny * nx floats as a Middlebury .flo or a PFM
+ * flow, chosen by the extension of the path. .flo samples are little endian; PFM
+ * samples keep the endianness of the host, given by the sign of the scale, and
+ * have a third channel of zeros.
+ */
+inline void write_flow(const std::string & path, const float *u, const float *v, const std::ptrdiff_t nx,
+                       const std::ptrdiff_t ny) {
+    const std::string extension = path_extension(path);
+    if (!writable_flow(path))
+        throw std::runtime_error("Unknown flow extension '" + extension + "', expected .flo or .pfm");
+
+    std::FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f)
+        throw std::runtime_error("Can not create " + path);
+
+    try {
+        if (extension == "flo") {
+            const bool swap = !little_endian_host();
+            int32_t size[2] = {int32_t(nx), int32_t(ny)};
+            for (auto & s : size)
+                s = load_int32(reinterpret_cast<const uint8_t *>(&s), swap);
+            if (std::fwrite("PIEH", 1, 4, f) != 4 || std::fwrite(size, sizeof(size), 1, f) != 1)
+                throw std::runtime_error("Can not write " + path);
+            write_flow_samples(f, u, v, nx, ny, 2, false, swap);
+        } else {
+            if (std::fprintf(f, "PF\n%td %td\n%s\n", nx, ny, little_endian_host() ? "-1.0" : "1.0") < 0)
+                throw std::runtime_error("Can not write " + path);
+            write_flow_samples(f, u, v, nx, ny, 3, true, false);
+        }
+    } catch (...) {
+        std::fclose(f);
+        throw;
+    }
+    if (std::fclose(f) != 0)
+        throw std::runtime_error("Can not write " + path);
+}
+
+
+/**
+ * Read-only file mapped in memory. Pages are only faulted in when they are read,
+ * so a flow can be inverted while the end of the file is still on its way; the
+ * kernel is asked to read ahead. Files that can not be mapped, like pipes, and
+ * systems without mmap fall back to reading the whole file.
+ */
+class mapped_file {
+public:
+    explicit mapped_file(const std::string & path) {
+#ifdef FLOW_IO_MMAP
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Can not open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *p = ::mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ::madvise(p, std::size_t(st.st_size), MADV_WILLNEED);
+                data_ = static_cast<const uint8_t *>(p);
+                size_ = std::size_t(st.st_size);
+                mapped_ = true;
+                ::close(fd);
+                return;
+            }
+        }
+        uint8_t block[1 << 16];
+        ssize_t n;
+        while ((n = ::read(fd, block, sizeof(block))) > 0)
+            copy_.insert(copy_.end(), block, block + n);
+        ::close(fd);
+        if (n < 0)
+            throw std::runtime_error("Can not read " + path);
+#else
+        std::FILE *f = std::fopen(path.c_str(), "rb");
+        if (!f)
+            throw std::runtime_error("Can not open " + path);
+        uint8_t block[1 << 16];
+        std::size_t n;
+        while ((n = std::fread(block, 1, sizeof(block), f)) > 0)
+            copy_.insert(copy_.end(), block, block + n);
+        std::fclose(f);
+#endif
+        data_ = copy_.data();
+        size_ = copy_.size();
+    }
+
+    ~mapped_file() {
+#ifdef FLOW_IO_MMAP
+        if (mapped_)
+            ::munmap(const_cast<uint8_t *>(data_), size_);
+#endif
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file & operator=(const mapped_file &) = delete;
+
+    const uint8_t *data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    const uint8_t *data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<uint8_t> copy_;
+};
+
+#endif
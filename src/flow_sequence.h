@@ -0,0 +1,347 @@
+#ifndef FLOW_SEQUENCE_H
+#define FLOW_SEQUENCE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+#include "flow_io.h"
+
+/**
+ * Flow sequence container (.fseq): the flows of a video in a single file, with
+ * random access to the frames. Everything is little endian:
+ *
+ *   header  "FLOWSEQ1", nx, ny, frames and keyframe interval as uint32, the
+ *           quantization step as float32, 4 reserved bytes, index offset as uint64
+ *   frames  one DEFLATE stream per frame
+ *   index   offset (uint64) and size (uint32) of the stream of every frame
+ *
+ * Every sample is coded as a 32-bit word: the bits of the float when the step is
+ * 0, otherwise the nearest multiple of the step (NaN is kept). A frame is a
+ * keyframe every keyframe interval frames; keyframes predict a word from its left
+ * neighbour, the other frames from the same word of the previous frame. Residuals
+ * are zigzag coded so that small ones of both signs have zero high bytes, and
+ * split in byte planes before DEFLATE: the u component then the v one, each as
+ * the first, second, third and fourth bytes of its residuals.
+ */
+
+static const char flow_sequence_magic[8] = {'F', 'L', 'O', 'W', 'S', 'E', 'Q', '1'};
+static const std::size_t flow_sequence_header_bytes = 40;
+static const std::size_t flow_sequence_entry_bytes = 12;
+
+// Quantized word of a NaN sample
+static const uint32_t flow_sequence_nan = 0x80000000u;
+
+
+inline void store_le32(uint8_t *p, const uint32_t value) {
+    for (int k = 0; k < 4; k++)
+        p[k] = uint8_t(value >> 8 * k);
+}
+
+inline void store_le64(uint8_t *p, const uint64_t value) {
+    for (int k = 0; k < 8; k++)
+        p[k] = uint8_t(value >> 8 * k);
+}
+
+inline uint32_t load_le32(const uint8_t *p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+inline uint64_t load_le64(const uint8_t *p) {
+    return uint64_t(load_le32(p)) | uint64_t(load_le32(p + 4)) << 32;
+}
+
+
+inline uint32_t zigzag(const uint32_t residual) { return residual << 1 ^ (0u - (residual >> 31)); }
+inline uint32_t unzigzag(const uint32_t code) { return code >> 1 ^ (0u - (code & 1)); }
+
+
+inline uint32_t sample_word(const float sample, const float step) {
+    if (step == 0) {
+        uint32_t word;
+        std::memcpy(&word, &sample, 4);
+        return word;
+    }
+    if (std::isnan(sample))
+        return flow_sequence_nan;
+    const double limit = std::numeric_limits<int32_t>::max();
+    const double q = std::max(-limit, std::min(limit, std::nearbyint(double(sample) / step)));
+    return uint32_t(int32_t(q));
+}
+
+
+// Samples of n words, without branches so that the loop is vectorized
+inline void word_samples(const uint32_t *words, const std::ptrdiff_t n, const float step, float *samples) {
+    if (step == 0) {
+        std::memcpy(samples, words, 4 * n);
+        return;
+    }
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (std::ptrdiff_t i = 0; i < n; i++) {
+        const float sample = float(int32_t(words[i])) * step;
+        samples[i] = words[i] == flow_sequence_nan ? nan : sample;
+    }
+}
+
+
+/**
+ * Residuals of the ny * nx words of a component, split in the four byte planes
+ * of planes. previous is the same component in the previous frame, or null for a
+ * keyframe.
+ */
+inline void encode_words(const uint32_t *words, const uint32_t *previous, const std::ptrdiff_t ny,
+                         const std::ptrdiff_t nx, uint8_t *planes) {
+    const std::ptrdiff_t n = ny * nx;
+    for (std::ptrdiff_t y = 0; y < ny; y++) {
+        for (std::ptrdiff_t x = 0; x < nx; x++) {
+            const std::ptrdiff_t i = y * nx + x;
+            const uint32_t prediction = previous ? previous[i] : x > 0 ? words[i - 1] : 0;
+            const uint32_t code = zigzag(words[i] - prediction);
+            planes[i] = uint8_t(code);
+            planes[n + i] = uint8_t(code >> 8);
+            planes[2 * n + i] = uint8_t(code >> 16);
+            planes[3 * n + i] = uint8_t(code >> 24);
+        }
+    }
+}
+
+
+/**
+ * Inverse of encode_words(). words holds the component in the previous frame,
+ * and is updated in place; keyframes ignore it.
+ */
+inline void decode_words(const uint8_t *planes, const bool keyframe, const std::ptrdiff_t ny,
+                         const std::ptrdiff_t nx, uint32_t *words) {
+    const std::ptrdiff_t n = ny * nx;
+    const uint8_t *b0 = planes, *b1 = planes + n, *b2 = planes + 2 * n, *b3 = planes + 3 * n;
+    if (!keyframe) {
+        for (std::ptrdiff_t i = 0; i < n; i++)
+            words[i] += unzigzag(uint32_t(b0[i]) | uint32_t(b1[i]) << 8 | uint32_t(b2[i]) << 16 | uint32_t(b3[i]) << 24);
+        return;
+    }
+    for (std::ptrdiff_t y = 0; y < ny; y++) {
+        uint32_t word = 0;
+        for (std::ptrdiff_t i = y * nx; i < (y + 1) * nx; i++) {
+            word += unzigzag(uint32_t(b0[i]) | uint32_t(b1[i]) << 8 | uint32_t(b2[i]) << 16 | uint32_t(b3[i]) << 24);
+            words[i] = word;
+        }
+    }
+}
+
+
+inline void check_sequence_size(const std::ptrdiff_t ny, const std::ptrdiff_t nx) {
+    check_flow_size(ny, nx, 0, 0);
+    if (8 * ny * nx > std::ptrdiff_t(std::numeric_limits<uint32_t>::max()) / 2)
+        throw std::runtime_error("Flow too large for a flow sequence");
+}
+
+
+/**
+ * Appends frames to a new flow sequence file. The index and the header are
+ * written by close(), or by the destructor if close() was not called.
+ */
+class flow_sequence_writer {
+public:
+    flow_sequence_writer(const std::string & path, const std::ptrdiff_t nx, const std::ptrdiff_t ny,
+                         const float step = 0, const int keyframe_interval = 16, const int level = 6)
+            : path_(path), nx_(nx), ny_(ny), step_(step), interval_(keyframe_interval), level_(level) {
+        check_sequence_size(ny, nx);
+        if (!(step >= 0) || std::isinf(step))
+            throw std::runtime_error("Quantization step must be 0 or positive");
+        if (keyframe_interval < 1)
+            throw std::runtime_error("Keyframe interval must be at least 1");
+        if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION)
+            throw std::runtime_error("Compression level must be between -1 and 9");
+
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_)
+            throw std::runtime_error("Can not create " + path);
+        const uint8_t header[flow_sequence_header_bytes] = {};
+        if (std::fwrite(header, sizeof(header), 1, file_) != 1)
+            fail();
+        offset_ = flow_sequence_header_bytes;
+
+        words_.resize(2 * nx * ny);
+        previous_.resize(2 * nx * ny);
+        planes_.resize(8 * nx * ny);
+        compressed_.resize(compressBound(uLong(planes_.size())));
+    }
+
+    ~flow_sequence_writer() {
+        if (file_) {
+            try {
+                close();
+            } catch (const std::exception &) {
+            }
+        }
+    }
+
+    flow_sequence_writer(const flow_sequence_writer &) = delete;
+    flow_sequence_writer & operator=(const flow_sequence_writer &) = delete;
+
+    // Append a frame given by planar u and v buffers of ny * nx floats
+    void write(const float *u, const float *v) {
+        if (!file_)
+            throw std::runtime_error("Flow sequence " + path_ + " is closed");
+        const std::ptrdiff_t n = nx_ * ny_;
+        const bool keyframe = index_.size() % interval_ == 0;
+        for (std::ptrdiff_t i = 0; i < n; i++) {
+            words_[i] = sample_word(u[i], step_);
+            words_[n + i] = sample_word(v[i], step_);
+        }
+        for (int c = 0; c < 2; c++)
+            encode_words(&words_[c * n], keyframe ? nullptr : &previous_[c * n], ny_, nx_, &planes_[4 * c * n]);
+
+        uLongf size = uLongf(compressed_.size());
+        if (compress2(compressed_.data(), &size, planes_.data(), uLong(planes_.size()), level_) != Z_OK)
+            throw std::runtime_error("Can not compress frame " + std::to_string(index_.size()));
+        if (std::fwrite(compressed_.data(), 1, size, file_) != size)
+            fail();
+        index_.emplace_back(offset_, uint32_t(size));
+        offset_ += size;
+        words_.swap(previous_);
+    }
+
+    // Write the index and the header, and close the file
+    void close() {
+        if (!file_)
+            return;
+        std::vector<uint8_t> index(index_.size() * flow_sequence_entry_bytes);
+        for (std::size_t k = 0; k < index_.size(); k++) {
+            store_le64(&index[k * flow_sequence_entry_bytes], index_[k].first);
+            store_le32(&index[k * flow_sequence_entry_bytes + 8], index_[k].second);
+        }
+        uint8_t header[flow_sequence_header_bytes] = {};
+        std::memcpy(header, flow_sequence_magic, 8);
+        store_le32(header + 8, uint32_t(nx_));
+        store_le32(header + 12, uint32_t(ny_));
+        store_le32(header + 16, uint32_t(index_.size()));
+        store_le32(header + 20, uint32_t(interval_));
+        uint32_t step;
+        std::memcpy(&step, &step_, 4);
+        store_le32(header + 24, step);
+        store_le64(header + 32, offset_);
+
+        if ((!index.empty() && std::fwrite(index.data(), index.size(), 1, file_) != 1) ||
+            std::fseek(file_, 0, SEEK_SET) != 0 || std::fwrite(header, sizeof(header), 1, file_) != 1)
+            fail();
+        const int closed = std::fclose(file_);
+        file_ = nullptr;
+        if (closed != 0)
+            throw std::runtime_error("Can not write " + path_);
+    }
+
+    std::ptrdiff_t nx() const { return nx_; }
+    std::ptrdiff_t ny() const { return ny_; }
+    std::ptrdiff_t frames() const { return std::ptrdiff_t(index_.size()); }
+
+private:
+    [[noreturn]] void fail() {
+        std::fclose(file_);
+        file_ = nullptr;
+        throw std::runtime_error("Can not write " + path_);
+    }
+
+    std::string path_;
+    std::FILE *file_ = nullptr;
+    std::ptrdiff_t nx_, ny_;
+    float step_;
+    std::size_t interval_;
+    int level_;
+    uint64_t offset_ = 0;
+    std::vector<uint32_t> words_, previous_;
+    std::vector<uint8_t> planes_, compressed_;
+    std::vector<std::pair<uint64_t, uint32_t>> index_;
+};
+
+
+/**
+ * Random access to the frames of a flow sequence. The file is mapped, and the
+ * reader keeps the last decoded frame: reading the frames in order only decodes
+ * each one once, other frames are decoded from their keyframe.
+ */
+class flow_sequence_reader {
+public:
+    explicit flow_sequence_reader(const std::string & path) : file_(path) {
+        const uint8_t *data = file_.data();
+        const std::size_t size = file_.size();
+        if (size < flow_sequence_header_bytes || std::memcmp(data, flow_sequence_magic, 8) != 0)
+            throw std::runtime_error(path + " is not a flow sequence");
+
+        nx_ = load_le32(data + 8);
+        ny_ = load_le32(data + 12);
+        frames_ = load_le32(data + 16);
+        interval_ = load_le32(data + 20);
+        const uint32_t step = load_le32(data + 24);
+        std::memcpy(&step_, &step, 4);
+        const uint64_t index_offset = load_le64(data + 32);
+        check_sequence_size(ny_, nx_);
+        if (interval_ < 1 || !(step_ >= 0) || std::isinf(step_) || index_offset < flow_sequence_header_bytes ||
+            index_offset > size || (size - index_offset) / flow_sequence_entry_bytes < std::size_t(frames_))
+            throw std::runtime_error("Invalid flow sequence header in " + path);
+
+        index_.resize(frames_);
+        for (std::ptrdiff_t k = 0; k < frames_; k++) {
+            const uint8_t *entry = data + index_offset + k * flow_sequence_entry_bytes;
+            index_[k] = {load_le64(entry), load_le32(entry + 8)};
+            if (index_[k].first < flow_sequence_header_bytes || index_[k].first > index_offset ||
+                index_[k].second > index_offset - index_[k].first)
+                throw std::runtime_error("Invalid flow sequence index in " + path);
+        }
+        words_.resize(2 * nx_ * ny_);
+        planes_.resize(8 * nx_ * ny_);
+    }
+
+    std::ptrdiff_t nx() const { return nx_; }
+    std::ptrdiff_t ny() const { return ny_; }
+    std::ptrdiff_t frames() const { return frames_; }
+    float step() const { return step_; }
+
+    // Decode a frame into planar u and v buffers of ny * nx floats
+    void read(const std::ptrdiff_t frame, float *u, float *v) {
+        if (frame < 0 || frame >= frames_)
+            throw std::out_of_range("Frame " + std::to_string(frame) + " out of a sequence of " +
+                                    std::to_string(frames_));
+        const std::ptrdiff_t keyframe = frame - frame % interval_;
+        const std::ptrdiff_t first = current_ >= keyframe && current_ <= frame ? current_ + 1 : keyframe;
+        current_ = -1;
+        for (std::ptrdiff_t k = first; k <= frame; k++)
+            decode(k);
+        current_ = frame;
+
+        const std::ptrdiff_t n = nx_ * ny_;
+        word_samples(&words_[0], n, step_, u);
+        word_samples(&words_[n], n, step_, v);
+    }
+
+private:
+    void decode(const std::ptrdiff_t frame) {
+        const std::ptrdiff_t n = nx_ * ny_;
+        uLongf size = uLongf(planes_.size());
+        if (uncompress(planes_.data(), &size, file_.data() + index_[frame].first, index_[frame].second) != Z_OK ||
+            size != planes_.size())
+            throw std::runtime_error("Corrupt flow sequence frame " + std::to_string(frame));
+        for (int c = 0; c < 2; c++)
+            decode_words(&planes_[4 * c * n], frame % interval_ == 0, ny_, nx_, &words_[c * n]);
+    }
+
+    mapped_file file_;
+    std::ptrdiff_t nx_, ny_, frames_, interval_;
+    float step_;
+    std::ptrdiff_t current_ = -1;
+    std::vector<std::pair<uint64_t, uint32_t>> index_;
+    std::vector<uint32_t> words_;
+    std::vector<uint8_t> planes_;
+};
+
+#endif
@@ -1,238 +1,321 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 #include <iostream>
+#include <memory>
 #include <cmath>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "inverse_optical_flow.h"
+#include "flow_fill.h"
+#include "flow_io.h"
+#include "flow_sequence.h"
 
 #define STRINGIFY(x) #x
 #define MACRO_STRINGIFY(x) STRINGIFY(x)
 
-#ifndef WEIGHT_TH
-#define WEIGHT_TH 0.25
-#endif
-#ifndef MOTION_TH
-#define MOTION_TH 0.25
-#endif
-
 namespace py = pybind11;
 
+// Instrumentation of the estimations, off by default
+static bool stats_enabled = false;
+static thread_local inversion_stats last_stats;
+
+
+// Stats of the estimation about to run, or null when the instrumentation is off
+static inversion_stats * begin_stats() {
+    if (!stats_enabled)
+        return nullptr;
+    last_stats = inversion_stats();
+    return &last_stats;
+}
+
+
+void enable_stats(const bool enabled) {
+    stats_enabled = enabled;
+}
 
-auto max_method(const py::array_t<float> & flow_array) -> std::pair<py::array_t<float>, py::array_t<uint8_t>> {
-    auto flow = flow_array.unchecked<3>();
-    const auto ch = flow.shape(0);
-    const auto ny = flow.shape(1);
-    const auto nx = flow.shape(2);
-    if (ch != 2)
+
+auto stats() -> py::dict {
+    py::dict d;
+    d["init_ns"] = last_stats.init_ns;
+    d["splat_ns"] = last_stats.splat_ns;
+    d["normalize_ns"] = last_stats.normalize_ns;
+    d["fill_ns"] = last_stats.fill_ns;
+    d["sources"] = last_stats.sources;
+    d["accepted"] = last_stats.accepted;
+    d["rejected"] = last_stats.rejected;
+    d["averaged"] = last_stats.averaged;
+    d["disoccluded"] = last_stats.disoccluded;
+    d["fill_iterations"] = last_stats.fill_iterations;
+    return d;
+}
+
+
+static flow_view make_flow_view(const py::array_t<float> & flow_array) {
+    if (flow_array.ndim() != 3 || flow_array.shape(0) != 2)
         throw std::runtime_error("Input flow must have shape (2, ny, nx)");
+    const auto item = ssize_t(sizeof(float));
+    return {flow_array.data(), flow_array.shape(1), flow_array.shape(2),
+            flow_array.strides(0) / item, flow_array.strides(1) / item, flow_array.strides(2) / item};
+}
 
+
+// Output arrays: the inverse flow zeroed and every pixel of the mask disoccluded
+static auto make_outputs(const ssize_t ny, const ssize_t nx, inversion_stats * stats)
+        -> std::pair<py::array_t<float>, py::array_t<uint8_t>> {
+    const auto start = stats ? now_ns() : 0;
     auto inverse_flow_array = py::array_t<float>({ssize_t(2), ny, nx});
     auto disocclusion_mask_array = py::array_t<uint8_t>({ny, nx});
     inverse_flow_array[py::make_tuple(py::ellipsis())] = 0.f;
     disocclusion_mask_array[py::make_tuple(py::ellipsis())] = 1;
-    auto flow_i = inverse_flow_array.mutable_unchecked<3>();
-    auto disocclusion_mask = disocclusion_mask_array.mutable_unchecked<2>();
-
-    for (int y = 0; y < ny; y++) {
-        for (int x = 0; x < nx; x++) {
-            // warping the flow
-            const auto yw = float(y) + flow(1, y, x);
-            const auto xw = float(x) + flow(0, y, x);
-            // integer part of the warped position
-            auto yi = ssize_t(yw);
-            auto xi = ssize_t(xw);
-            // sign of the warped position
-            const int sy = (yw < 0) ? -1 : 1;
-            const int sx = (xw < 0) ? -1 : 1;
-            // warped position
-            ssize_t dy = yi + sy;
-            ssize_t dx = xi + sx;
-            // check that the warped position is inside the image
-            yi = std::max(ssize_t(0), std::min(ny - 1, yi));
-            xi = std::max(ssize_t(0), std::min(nx - 1, xi));
-            dy = std::max(ssize_t(0), std::min(ny - 1, dy));
-            dx = std::max(ssize_t(0), std::min(nx - 1, dx));
-            // compute the four proportions
-            const auto e1 = float(sx) * (xw - float(xi));
-            const auto E1 = 1.0f - e1;
-            const auto e2 = float(sy) * (yw - float(yi));
-            const auto E2 = 1.0f - e2;
-            // put in the four points the corresponding proportion
-            const auto w1 = E1 * E2;
-            const auto w2 = e1 * E2;
-            const auto w3 = E1 * e2;
-            const auto w4 = e1 * e2;
-            // compute the four distances
-            const float d  = std::pow(flow(1, y, x), 2) + std::pow(flow(0, y, x), 2);
-            const float d1 = std::pow(flow_i(1, yi, xi), 2) + std::pow(flow_i(0, yi, xi), 2);
-            const float d2 = std::pow(flow_i(1, yi, dx), 2) + std::pow(flow_i(0, yi, dx), 2);
-            const float d3 = std::pow(flow_i(1, dy, xi), 2) + std::pow(flow_i(0, dy, xi), 2);
-            const float d4 = std::pow(flow_i(1, dy, dx), 2) + std::pow(flow_i(0, dy, dx), 2);
-
-            // check if the warped position is occluded
-            if (w1 >= WEIGHT_TH && d >= d1) {
-                flow_i(0, yi, xi) = -flow(0, y, x);
-                flow_i(1, yi, xi) = -flow(1, y, x);
-                disocclusion_mask(yi, xi) = 0;
-            }
-
-            if (w2 >= WEIGHT_TH && d >= d2) {
-                flow_i(0, yi, dx) = -flow(0, y, x);
-                flow_i(1, yi, dx) = -flow(1, y, x);
-                disocclusion_mask(yi, dx) = 0;
-            }
-
-            if (w3 >= WEIGHT_TH && d >= d3) {
-                flow_i(0, dy, xi) = -flow(0, y, x);
-                flow_i(1, dy, xi) = -flow(1, y, x);
-                disocclusion_mask(dy, xi) = 0;
-            }
-
-            if (w4 >= WEIGHT_TH && d >= d4) {
-                flow_i(0, dy, dx) = -flow(0, y, x);
-                flow_i(1, dy, dx) = -flow(1, y, x);
-                disocclusion_mask(dy, dx) = 0;
-            }
-        }
+    if (stats)
+        stats->init_ns += now_ns() - start;
+    return std::make_pair(inverse_flow_array, disocclusion_mask_array);
+}
+
+
+// Output grid given either its shape (ny, nx) or its scale, a number or a (sy, sx) pair
+static target_grid make_output_grid(const flow_view & flow, const py::object & shape, const py::object & scale) {
+    if (!shape.is_none() && !scale.is_none())
+        throw std::runtime_error("Only one of shape and scale can be given");
+    if (!shape.is_none()) {
+        const auto dims = shape.cast<std::pair<ssize_t, ssize_t>>();
+        if (dims.first <= 0 || dims.second <= 0)
+            throw std::runtime_error("Output shape must be positive");
+        return {dims.first, dims.second, float(dims.first) / float(flow.ny), float(dims.second) / float(flow.nx)};
+    }
+    if (!scale.is_none()) {
+        auto factors = py::isinstance<py::sequence>(scale)
+            ? scale.cast<std::pair<float, float>>()
+            : std::make_pair(scale.cast<float>(), scale.cast<float>());
+        const auto ny = ssize_t(std::lround(float(flow.ny) * factors.first));
+        const auto nx = ssize_t(std::lround(float(flow.nx) * factors.second));
+        if (ny <= 0 || nx <= 0)
+            throw std::runtime_error("Output scale must be positive");
+        return {ny, nx, factors.first, factors.second};
     }
+    return {flow.ny, flow.nx};
+}
 
-    return std::make_pair(inverse_flow_array, disocclusion_mask_array);
+
+// Output grid restricted to the region of interest (x0, y0, x1, y1), if any
+static target_grid make_target_grid(const flow_view & flow, const py::object & shape, const py::object & scale,
+                                    const py::object & roi) {
+    auto grid = make_output_grid(flow, shape, scale);
+    if (!roi.is_none()) {
+        const auto box = roi.cast<std::tuple<ssize_t, ssize_t, ssize_t, ssize_t>>();
+        grid.x0 = std::get<0>(box);
+        grid.y0 = std::get<1>(box);
+        grid.x1 = std::get<2>(box);
+        grid.y1 = std::get<3>(box);
+        if (grid.x0 < 0 || grid.y0 < 0 || grid.x1 > grid.nx || grid.y1 > grid.ny || grid.x0 >= grid.x1 || grid.y0 >= grid.y1)
+            throw std::runtime_error("Region of interest must be a non empty (x0, y0, x1, y1) box inside the output");
+    }
+    return grid;
 }
 
 
-auto avg_method(const py::array_t<float> & flow_array) -> std::pair<py::array_t<float>, py::array_t<uint8_t>> {
-    auto flow = flow_array.unchecked<3>();
-    const auto ch = flow.shape(0);
-    const auto ny = flow.shape(1);
-    const auto nx = flow.shape(2);
-    if (ch != 2)
-        throw std::runtime_error("Input flow must have shape (2, ny, nx)");
+// Reject an unknown fill, or negative bounds of the bounded fill, before the estimation runs
+static void check_fill(const std::string & fill, int distance, double budget) {
+    if (!fill.empty() && fill != "push_pull" && fill != "harmonic" && fill != "bounded")
+        throw std::runtime_error("Fill must be \"push_pull\", \"harmonic\" or \"bounded\"");
+    if (distance < 0 || budget < 0)
+        throw std::runtime_error("Fill distance and budget must be non-negative");
+}
 
+
+// Fill the disoccluded pixels of the inverse flow with the given method, if any. The mask is kept,
+// except by the bounded fill which clears the pixels it reached within distance and budget (seconds)
+static void fill_outputs(std::pair<py::array_t<float>, py::array_t<uint8_t>> & outputs, const std::string & fill,
+                         int distance, double budget, inversion_stats * stats) {
+    if (fill.empty())
+        return;
+    const auto start = stats ? now_ns() : 0;
+    const auto ny = outputs.second.shape(0);
+    const auto nx = outputs.second.shape(1);
+    float *u = outputs.first.mutable_data();
+    int64_t iterations;
+    if (fill == "push_pull")
+        iterations = push_pull_fill(u, u + ny * nx, outputs.second.data(), uint8_t(0), ny, nx);
+    else if (fill == "harmonic")
+        iterations = harmonic_fill(u, u + ny * nx, outputs.second.data(), uint8_t(0), ny, nx);
+    else
+        iterations = bounded_fill(u, u + ny * nx, outputs.second.mutable_data(), uint8_t(0), ny, nx, distance,
+                                  int64_t(budget * 1e9));
+    if (stats) {
+        stats->fill_ns += now_ns() - start;
+        stats->fill_iterations += iterations;
+    }
+}
+
+
+auto max_method(const py::array_t<float> & flow_array, const py::object & shape, const py::object & scale,
+                const py::object & roi, const std::string & fill, int fill_distance, double fill_budget)
+        -> std::pair<py::array_t<float>, py::array_t<uint8_t>> {
+    check_fill(fill, fill_distance, fill_budget);
+    const auto flow = make_flow_view(flow_array);
+    const auto grid = make_target_grid(flow, shape, scale, roi);
+    auto stats = begin_stats();
+    auto outputs = make_outputs(grid.roi_ny(), grid.roi_nx(), stats);
+
+    max_inverse(flow, grid, outputs.first.mutable_data(), outputs.second.mutable_data(), nullptr, stats);
+    fill_outputs(outputs, fill, fill_distance, fill_budget, stats);
+
+    return outputs;
+}
+
+
+auto avg_method(const py::array_t<float> & flow_array, const py::object & shape, const py::object & scale,
+                const py::object & roi, const std::string & fill, int fill_distance, double fill_budget)
+        -> std::pair<py::array_t<float>, py::array_t<uint8_t>> {
+    check_fill(fill, fill_distance, fill_budget);
+    const auto flow = make_flow_view(flow_array);
+    const auto grid = make_target_grid(flow, shape, scale, roi);
+    auto stats = begin_stats();
     // Define the output arrays
-    auto inverse_flow_array = py::array_t<float>({ssize_t(2), ny, nx});
-    auto disocclusion_mask_array = py::array_t<uint8_t>({ny, nx});
-    inverse_flow_array[py::make_tuple(py::ellipsis())] = 0.f;
-    disocclusion_mask_array[py::make_tuple(py::ellipsis())] = 1;
+    auto outputs = make_outputs(grid.roi_ny(), grid.roi_nx(), stats);
+
+    avg_inverse(flow, grid, outputs.first.mutable_data(), outputs.second.mutable_data(), nullptr, stats);
+    fill_outputs(outputs, fill, fill_distance, fill_budget, stats);
+
+    return outputs;
+}
+
+
+// Update in place the inverse flow and disocclusion mask of previous_flow into the ones of flow
+static ssize_t update_method(const py::array_t<float> & previous_flow_array, const py::array_t<float> & flow_array,
+                             py::array_t<float, py::array::c_style> & inverse_flow_array,
+                             py::array_t<uint8_t, py::array::c_style> & disocclusion_mask_array, const bool average) {
+    const auto previous = make_flow_view(previous_flow_array);
+    const auto flow = make_flow_view(flow_array);
+    if (previous.ny != flow.ny || previous.nx != flow.nx)
+        throw std::runtime_error("Previous and new flows must have the same shape");
+    if (inverse_flow_array.ndim() != 3 || inverse_flow_array.shape(0) != 2 || disocclusion_mask_array.ndim() != 2 ||
+        disocclusion_mask_array.shape(0) != inverse_flow_array.shape(1) ||
+        disocclusion_mask_array.shape(1) != inverse_flow_array.shape(2))
+        throw std::runtime_error("Inverse flow must have shape (2, ny, nx) and disocclusion mask (ny, nx)");
+
+    const auto ny = inverse_flow_array.shape(1);
+    const auto nx = inverse_flow_array.shape(2);
+    const target_grid grid(ny, nx, float(ny) / float(flow.ny), float(nx) / float(flow.nx));
+    return update_inverse(previous, flow, grid, average,
+                          inverse_flow_array.mutable_data(), disocclusion_mask_array.mutable_data(), begin_stats());
+}
 
-    // Temporary arrays
-    auto avg_uv_array = py::array_t<float>({ssize_t(2), ny, nx});
-    auto wgt_array = py::array_t<float>({ny, nx});
-    auto d_array = py::array_t<float>({ny, nx});
-    avg_uv_array[py::make_tuple(py::ellipsis())] = 0.f;
-    wgt_array[py::make_tuple(py::ellipsis())] = 0.f;
-    d_array[py::make_tuple(py::ellipsis())] = 0.f;
-
-    auto flow_i = inverse_flow_array.mutable_unchecked<3>();
-    auto disocclusion_mask = disocclusion_mask_array.mutable_unchecked<2>();
-    auto avg_uv_ = avg_uv_array.mutable_unchecked<3>();
-    auto wgt_ = wgt_array.mutable_unchecked<2>();
-    auto d_ = d_array.mutable_unchecked<2>();
-
-    for (int y = 0; y < ny; y++) {
-        for (int x = 0; x < nx; x++) {
-            // warping the flow
-            const auto xw = float(x) + flow(0, y, x);
-            const auto yw = float(y) + flow(1, y, x);
-            // integer part of the warped position
-            auto xi = ssize_t(xw);
-            auto yi = ssize_t(yw);
-            // sign of the warped position
-            const int sx = (xw < 0) ? -1 : 1;
-            const int sy = (yw < 0) ? -1 : 1;
-            // warped position
-            ssize_t dx = xi + sx;
-            ssize_t dy = yi + sy;
-            // check that the warped position is inside the image
-            xi = std::max(ssize_t(0), std::min(nx - 1, xi));
-            yi = std::max(ssize_t(0), std::min(ny - 1, yi));
-            dx = std::max(ssize_t(0), std::min(nx - 1, dx));
-            dy = std::max(ssize_t(0), std::min(ny - 1, dy));
-            // compute the four proportions
-            const auto e1 = float(sx) * (xw - float(xi));
-            const auto E1 = 1.0f - e1;
-            const auto e2 = float(sy) * (yw - float(yi));
-            const auto E2 = 1.0f - e2;
-            // put in the four points the corresponding proportion
-            const auto w1 = E1 * E2;
-            const auto w2 = e1 * E2;
-            const auto w3 = E1 * e2;
-            const auto w4 = e1 * e2;
-            // compute the four distances
-            const auto d  = float(std::pow(flow(0, y, x), 2) + std::pow(flow(1, y, x), 2));
-            // select motion
-            if (d >= WEIGHT_TH) {
-                if (fabs(d - d_(yi, xi)) <= MOTION_TH) {
-                    avg_uv_(0, yi, xi) += flow(0, y, x) * w1;
-                    avg_uv_(1, yi, xi) += flow(1, y, x) * w1;
-                    wgt_(yi, xi) += w1;
-                    disocclusion_mask(yi, xi) = 0;
-                } else if (d >= d_(yi, xi)) {
-                    //if it is an occlusion we retain the highest value
-                    d_(yi, xi) = d;
-                    avg_uv_(0, yi, xi) = flow(0, y, x) * w1;
-                    avg_uv_(1, yi, xi) = flow(1, y, x) * w1;
-                    wgt_(yi, xi) = w1;
-                    disocclusion_mask(yi, xi) = 0;
-                }
-            }
-            if (d >= WEIGHT_TH) {
-                if (fabs(d - d_(yi, dx)) <= MOTION_TH) {
-                    avg_uv_(0, yi, dx) += flow(0, y, x) * w2;
-                    avg_uv_(1, yi, dx) += flow(1, y, x) * w2;
-                    wgt_(yi, dx) += w2;
-                    disocclusion_mask(yi, dx) = 0;
-                } else if (d >= d_(yi, dx)) {
-                    //if it is an occlusion we retain the highest value
-                    d_(yi, dx) = d;
-                    avg_uv_(0, yi, dx) = flow(0, y, x) * w2;
-                    avg_uv_(1, yi, dx) = flow(1, y, x) * w2;
-                    wgt_(yi, dx) = w2;
-                    disocclusion_mask(yi, dx) = 0;
-                }
-            }
-            if (d >= WEIGHT_TH) {
-                if (fabs(d - d_(dy, xi)) <= MOTION_TH) {
-                    avg_uv_(0, dy, xi) += flow(0, y, x) * w3;
-                    avg_uv_(1, dy, xi) += flow(1, y, x) * w3;
-                    wgt_(dy, xi) += w3;
-                    disocclusion_mask(dy, xi) = 0;
-                } else if (d >= d_(dy, xi)) {
-                    //if it is an occlusion we retain the highest value
-                    d_(dy, xi) = d;
-                    avg_uv_(0, dy, xi) = flow(0, y, x) * w3;
-                    avg_uv_(1, dy, xi) = flow(1, y, x) * w3;
-                    wgt_(dy, xi) = w3;
-                    disocclusion_mask(dy, xi) = 0;
-                }
-            }
-            if (d >= WEIGHT_TH) {
-                if (fabs(d - d_(dy, dx)) <= MOTION_TH) {
-                    avg_uv_(0, dy, dx) += flow(0, y, x) * w4;
-                    avg_uv_(1, dy, dx) += flow(1, y, x) * w4;
-                    wgt_(dy, dx) += w4;
-                    disocclusion_mask(dy, dx) = 0;
-                } else if (d >= d_(dy, dx)) {
-                    //if it is an occlusion we retain the highest value
-                    d_(dy, dx) = d;
-                    avg_uv_(0, dy, dx) = flow(0, y, x) * w4;
-                    avg_uv_(1, dy, dx) = flow(1, y, x) * w4;
-                    wgt_(dy, dx) = w4;
-                    disocclusion_mask(dy, dx) = 0;
-                }
-            }
-        }
+
+auto max_method_update(const py::array_t<float> & previous_flow_array, const py::array_t<float> & flow_array,
+                       py::array_t<float, py::array::c_style> & inverse_flow_array,
+                       py::array_t<uint8_t, py::array::c_style> & disocclusion_mask_array) -> ssize_t {
+    return update_method(previous_flow_array, flow_array, inverse_flow_array, disocclusion_mask_array, false);
+}
+
+
+auto avg_method_update(const py::array_t<float> & previous_flow_array, const py::array_t<float> & flow_array,
+                       py::array_t<float, py::array::c_style> & inverse_flow_array,
+                       py::array_t<uint8_t, py::array::c_style> & disocclusion_mask_array) -> ssize_t {
+    return update_method(previous_flow_array, flow_array, inverse_flow_array, disocclusion_mask_array, true);
+}
+
+
+auto compose(const std::vector<py::array_t<float>> & flow_arrays, const std::string & method) -> py::object {
+    if (flow_arrays.empty())
+        throw std::runtime_error("At least one flow is needed");
+
+    std::vector<flow_view> flows;
+    for (const auto & flow_array : flow_arrays) {
+        flows.push_back(make_flow_view(flow_array));
+        if (flows.back().ny != flows[0].ny || flows.back().nx != flows[0].nx)
+            throw std::runtime_error("All flows must have the same shape");
     }
+    const auto ny = flows[0].ny;
+    const auto nx = flows[0].nx;
 
-    for (int y = 0; y < ny; y++) {
-        for (int x = 0; x < nx; x++) {
-            if (disocclusion_mask(y, x) == 0) {
-                flow_i(0, y, x) = -avg_uv_(0, y, x) / wgt_(y, x);
-                flow_i(1, y, x) = -avg_uv_(1, y, x) / wgt_(y, x);
-            }
-        }
+    if (method.empty()) {
+        auto composed_flow_array = py::array_t<float>({ssize_t(2), ny, nx});
+        compose_flows(flows.data(), flows.size(), composed_flow_array.mutable_data());
+        return composed_flow_array;
     }
+    if (method != "max" && method != "avg")
+        throw std::runtime_error("Inversion method must be \"max\" or \"avg\"");
 
-    return std::make_pair(inverse_flow_array, disocclusion_mask_array);
+    auto stats = begin_stats();
+    auto outputs = make_outputs(ny, nx, stats);
+
+    compose_inverse(flows.data(), flows.size(), method == "avg",
+                    outputs.first.mutable_data(), outputs.second.mutable_data(), stats);
+
+    return py::make_tuple(outputs.first, outputs.second);
+}
+
+auto read_flow_bytes(const py::buffer & buffer) -> py::array_t<float> {
+    const py::buffer_info info = buffer.request();
+    if (info.ndim != 1 || info.itemsize != 1 || info.strides[0] != 1)
+        throw std::runtime_error("Encoded flow must be a contiguous bytes-like object");
+    const auto *data = static_cast<const uint8_t *>(info.ptr);
+
+    const flow_layout layout = parse_flow(data, size_t(info.size));
+    auto flow_array = py::array_t<float>({ssize_t(2), layout.ny, layout.nx});
+    float *u = flow_array.mutable_data();
+    decode_flow(data, layout, u, u + layout.ny * layout.nx);
+    return flow_array;
 }
 
+
+auto map_flow(const std::string & path) -> py::array_t<float> {
+    std::unique_ptr<mapped_file> file(new mapped_file(path));
+    const flow_layout layout = parse_flow(file->data(), file->size());
+
+    if (!viewable_flow(file->data(), layout)) {
+        auto flow_array = py::array_t<float>({ssize_t(2), layout.ny, layout.nx});
+        float *u = flow_array.mutable_data();
+        decode_flow(file->data(), layout, u, u + layout.ny * layout.nx);
+        return flow_array;
+    }
+
+    // The array keeps the mapping alive, and is read-only like the mapping
+    const flow_view view = view_flow(file->data(), layout);
+    py::capsule owner(file.get(), [](void *f) { delete static_cast<mapped_file *>(f); });
+    file.release();
+    py::array_t<float> flow_array({ssize_t(2), layout.ny, layout.nx}, {layout.sc, layout.sy, layout.sx},
+                                  view.data, owner);
+    flow_array.attr("setflags")(py::arg("write") = false);
+    return flow_array;
+}
+
+
+void save_flow_sequence(const std::string & path, const py::iterable & flows, const float step,
+                        const int keyframe_interval, const int level) {
+    std::unique_ptr<flow_sequence_writer> writer;
+    for (const auto & flow : flows) {
+        const auto flow_array = py::array_t<float, py::array::c_style | py::array::forcecast>::ensure(flow);
+        if (!flow_array || flow_array.ndim() != 3 || flow_array.shape(0) != 2)
+            throw std::runtime_error("Flows must have shape (2, ny, nx)");
+        const auto ny = flow_array.shape(1);
+        const auto nx = flow_array.shape(2);
+        if (!writer)
+            writer.reset(new flow_sequence_writer(path, nx, ny, step, keyframe_interval, level));
+        else if (nx != writer->nx() || ny != writer->ny())
+            throw std::runtime_error("All the flows of a sequence must have the same shape");
+        writer->write(flow_array.data(), flow_array.data() + ny * nx);
+    }
+    if (!writer)
+        throw std::runtime_error("A flow sequence needs at least one flow");
+    writer->close();
+}
+
+
+auto read_flow_sequence_frame(flow_sequence_reader & sequence, ssize_t frame) -> py::array_t<float> {
+    if (frame < 0)
+        frame += sequence.frames();
+    auto flow_array = py::array_t<float>({ssize_t(2), sequence.ny(), sequence.nx()});
+    float *u = flow_array.mutable_data();
+    sequence.read(frame, u, u + sequence.ny() * sequence.nx());
+    return flow_array;
+}
+
+
 PYBIND11_MODULE(inverse_optical_flow, m) {
     m.doc() = R"pbdoc(
         Compute the inverse optical flow
@@ -245,9 +328,61 @@ PYBIND11_MODULE(inverse_optical_flow, m) {
 
            max_method
            avg_method
+           max_method_update
+           avg_method_update
+           compose
+           read_flow_bytes
+           map_flow
+           save_flow_sequence
+           FlowSequence
+           enable_stats
+           stats
     )pbdoc";
-    m.def("max_method", &max_method, py::arg().noconvert(), "Estimate inverse optical flow using max distance");
-    m.def("avg_method", &avg_method, py::arg().noconvert(), "Estimate inverse optical flow averaging closest points");
+    m.def("max_method", &max_method, py::arg("flow").noconvert(), py::arg("shape") = py::none(),
+          py::arg("scale") = py::none(), py::arg("roi") = py::none(), py::arg("fill") = "",
+          py::arg("fill_distance") = 0, py::arg("fill_budget") = 0.0,
+          "Estimate inverse optical flow using max distance, optionally on an output grid of another shape or scale "
+          "and only inside the region of interest (x0, y0, x1, y1). With fill=\"push_pull\" or \"harmonic\" the "
+          "disoccluded pixels are filled, and still flagged in the mask. With fill=\"bounded\" they are filled up to "
+          "fill_distance pixels away and for fill_budget seconds, if positive, and the filled ones are cleared");
+    m.def("avg_method", &avg_method, py::arg("flow").noconvert(), py::arg("shape") = py::none(),
+          py::arg("scale") = py::none(), py::arg("roi") = py::none(), py::arg("fill") = "",
+          py::arg("fill_distance") = 0, py::arg("fill_budget") = 0.0,
+          "Estimate inverse optical flow averaging closest points, optionally on an output grid of another shape or "
+          "scale and only inside the region of interest (x0, y0, x1, y1). With fill=\"push_pull\" or \"harmonic\" "
+          "the disoccluded pixels are filled, and still flagged in the mask. With fill=\"bounded\" they are filled up "
+          "to fill_distance pixels away and for fill_budget seconds, if positive, and the filled ones are cleared");
+    m.def("max_method_update", &max_method_update, py::arg("previous_flow").noconvert(), py::arg("flow").noconvert(),
+          py::arg("inverse_flow").noconvert(), py::arg("disocclusion_mask").noconvert(),
+          "Update in place the max method inverse flow and disocclusion mask of previous_flow into the ones of flow, "
+          "estimating again only the regions reached by the changes. Returns the number of pixels estimated again");
+    m.def("avg_method_update", &avg_method_update, py::arg("previous_flow").noconvert(), py::arg("flow").noconvert(),
+          py::arg("inverse_flow").noconvert(), py::arg("disocclusion_mask").noconvert(),
+          "Update in place the avg method inverse flow and disocclusion mask of previous_flow into the ones of flow, "
+          "estimating again only the regions reached by the changes. Returns the number of pixels estimated again");
+    m.def("compose", &compose, py::arg("flows"), py::arg("method") = "",
+          "Compose a sequence of flows, or estimate the inverse of the composition with method \"max\" or \"avg\"");
+    m.def("read_flow_bytes", &read_flow_bytes, py::arg("buffer"),
+          "Decode a Middlebury .flo or PFM flow held in memory into an array of shape (2, ny, nx)");
+    m.def("map_flow", &map_flow, py::arg("path"),
+          "Map a .flo, PFM or .npy flow file and return a read-only (2, ny, nx) view of its samples, without copy "
+          "when they are aligned floats of native endianness");
+    m.def("save_flow_sequence", &save_flow_sequence, py::arg("path"), py::arg("flows"), py::arg("step") = 0.0f,
+          py::arg("keyframe_interval") = 16, py::arg("level") = 6,
+          "Save (2, ny, nx) flows as a compressed flow sequence, lossless or quantized to multiples of step, with a "
+          "keyframe every keyframe_interval frames and the given DEFLATE level");
+    py::class_<flow_sequence_reader>(m, "FlowSequence",
+                                     "Random access to the frames of a flow sequence written by save_flow_sequence")
+        .def(py::init<const std::string &>(), py::arg("path"))
+        .def("__len__", &flow_sequence_reader::frames)
+        .def("__getitem__", &read_flow_sequence_frame, py::arg("frame"),
+             "Decode a frame into an array of shape (2, ny, nx); reading in order decodes each frame once")
+        .def_property_readonly("shape", [](const flow_sequence_reader & s) { return py::make_tuple(s.ny(), s.nx()); })
+        .def_property_readonly("step", &flow_sequence_reader::step);
+    m.def("enable_stats", &enable_stats, py::arg("enabled") = true,
+          "Record per phase timers and counters of every estimation, off by default");
+    m.def("stats", &stats,
+          "Timers (ns) and counters of the last estimation of this thread when the instrumentation is enabled");
 #ifdef VERSION_INFO
     m.attr("__version__") = MACRO_STRINGIFY(VERSION_INFO);
 #else
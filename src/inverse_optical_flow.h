@@ -0,0 +1,628 @@
+#ifndef INVERSE_OPTICAL_FLOW_H
+#define INVERSE_OPTICAL_FLOW_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifndef WEIGHT_TH
+#define WEIGHT_TH 0.25
+#endif
+#ifndef MOTION_TH
+#define MOTION_TH 0.25
+#endif
+
+// Number of rows composed at once before they are consumed by the splatting
+#ifndef COMPOSE_STRIP_ROWS
+#define COMPOSE_STRIP_ROWS 16
+#endif
+
+// Side of the source tiles culled against the region of interest
+#ifndef SPLAT_TILE
+#define SPLAT_TILE 32
+#endif
+
+
+/**
+ * Read-only view of a (2, ny, nx) flow field. Strides are given in elements, so
+ * planar, interleaved (ny, nx, 2) and sliced arrays can be read without a copy.
+ */
+struct flow_view {
+    const float *data;
+    std::ptrdiff_t ny, nx;
+    std::ptrdiff_t sc, sy, sx;
+
+    float u(std::ptrdiff_t y, std::ptrdiff_t x) const { return data[y * sy + x * sx]; }
+    float v(std::ptrdiff_t y, std::ptrdiff_t x) const { return data[sc + y * sy + x * sx]; }
+};
+
+
+/**
+ * Grid on which the warped positions are splatted. It has its own size and the
+ * scale from the source grid, so the inverse flow can be estimated directly at a
+ * coarser or finer resolution. Pixel centers are kept aligned when rescaling, and
+ * the inverse flow is given in target pixels.
+ *
+ * Only the region of interest [y0, y1) x [x0, x1) of the grid is stored; output
+ * buffers are (y1 - y0) x (x1 - x0). Warped positions are still clamped to the
+ * whole grid, so the region holds the same values as the full estimation.
+ */
+struct target_grid {
+    std::ptrdiff_t ny, nx;
+    float sy, sx;
+    std::ptrdiff_t y0, x0, y1, x1;
+
+    target_grid(const std::ptrdiff_t ny, const std::ptrdiff_t nx, const float sy = 1.f, const float sx = 1.f)
+        : ny(ny), nx(nx), sy(sy), sx(sx), y0(0), x0(0), y1(ny), x1(nx) {}
+
+    bool scaled() const { return sy != 1.f || sx != 1.f; }
+    float map_y(const float y) const { return scaled() ? (y + 0.5f) * sy - 0.5f : y; }
+    float map_x(const float x) const { return scaled() ? (x + 0.5f) * sx - 0.5f : x; }
+
+    bool cropped() const { return y0 != 0 || x0 != 0 || y1 != ny || x1 != nx; }
+    std::ptrdiff_t roi_ny() const { return y1 - y0; }
+    std::ptrdiff_t roi_nx() const { return x1 - x0; }
+    std::ptrdiff_t roi_size() const { return roi_ny() * roi_nx(); }
+    bool inside(const std::ptrdiff_t y, const std::ptrdiff_t x) const { return y >= y0 && y < y1 && x >= x0 && x < x1; }
+    std::ptrdiff_t index(const std::ptrdiff_t y, const std::ptrdiff_t x) const { return (y - y0) * roi_nx() + (x - x0); }
+};
+
+
+/**
+ * Per phase timers, in nanoseconds, and counters of one estimation. Kernels only
+ * record them when given a non null pointer.
+ */
+struct inversion_stats {
+    int64_t init_ns = 0, splat_ns = 0, normalize_ns = 0, fill_ns = 0;
+    // source pixels splatted, corner writes accepted and rejected by the distance test
+    int64_t sources = 0, accepted = 0, rejected = 0;
+    // target pixels averaged, left disoccluded, and iterations of the fill
+    int64_t averaged = 0, disoccluded = 0, fill_iterations = 0;
+};
+
+
+inline int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+inline void count_disoccluded(const uint8_t *disocclusion_mask, const std::ptrdiff_t size, inversion_stats *stats) {
+    if (stats)
+        stats->disoccluded += std::count(disocclusion_mask, disocclusion_mask + size, uint8_t(1));
+}
+
+
+// squared norm of the motion, rounded the same way as float(pow(u, 2) + pow(v, 2))
+inline float squared_norm(const float u, const float v) {
+    return float(double(u) * double(u) + double(v) * double(v));
+}
+
+
+/**
+ * Bilinear splatting footprint of the warped position (xw, yw) on a ny x nx grid:
+ * the four clamped corners and their proportions.
+ */
+struct splat_footprint {
+    std::ptrdiff_t xi, yi, dx, dy;
+    float w1, w2, w3, w4;
+
+    splat_footprint(const float xw, const float yw, const std::ptrdiff_t ny, const std::ptrdiff_t nx) {
+        // integer part of the warped position
+        xi = std::ptrdiff_t(xw);
+        yi = std::ptrdiff_t(yw);
+        // sign of the warped position
+        const int sx = (xw < 0) ? -1 : 1;
+        const int sy = (yw < 0) ? -1 : 1;
+        // warped position
+        dx = xi + sx;
+        dy = yi + sy;
+        // check that the warped position is inside the image
+        xi = std::max(std::ptrdiff_t(0), std::min(nx - 1, xi));
+        yi = std::max(std::ptrdiff_t(0), std::min(ny - 1, yi));
+        dx = std::max(std::ptrdiff_t(0), std::min(nx - 1, dx));
+        dy = std::max(std::ptrdiff_t(0), std::min(ny - 1, dy));
+        // compute the four proportions
+        const auto e1 = float(sx) * (xw - float(xi));
+        const auto E1 = 1.0f - e1;
+        const auto e2 = float(sy) * (yw - float(yi));
+        const auto E2 = 1.0f - e2;
+        // put in the four points the corresponding proportion
+        w1 = E1 * E2;
+        w2 = e1 * E2;
+        w3 = E1 * e2;
+        w4 = e1 * e2;
+    }
+};
+
+
+/**
+ * Splat the motion (u, v) of the source pixel (x, y) keeping, in every corner, the
+ * largest motion. flow_i is a planar (2, roi_ny, roi_nx) buffer.
+ */
+inline void max_splat(
+    const std::ptrdiff_t y, const std::ptrdiff_t x, float u, float v,
+    float *flow_i, uint8_t *disocclusion_mask, const target_grid &grid, inversion_stats *stats = nullptr
+) {
+    const splat_footprint f(grid.map_x(float(x) + u), grid.map_y(float(y) + v), grid.ny, grid.nx);
+    const std::ptrdiff_t size = grid.roi_size();
+    // motion measured in target pixels
+    u *= grid.sx;
+    v *= grid.sy;
+    const std::ptrdiff_t cy[4] = {f.yi, f.yi, f.dy, f.dy};
+    const std::ptrdiff_t cx[4] = {f.xi, f.dx, f.xi, f.dx};
+    const float w[4] = {f.w1, f.w2, f.w3, f.w4};
+    // compute the distances
+    const float d = squared_norm(u, v);
+    if (stats)
+        stats->sources++;
+
+    for (int k = 0; k < 4; k++) {
+        if (!grid.inside(cy[k], cx[k]))
+            continue;
+        const auto p = grid.index(cy[k], cx[k]);
+        // check if the warped position is occluded
+        if (w[k] >= WEIGHT_TH && d >= squared_norm(flow_i[p], flow_i[size + p])) {
+            flow_i[p] = -u;
+            flow_i[size + p] = -v;
+            disocclusion_mask[p] = 0;
+            if (stats)
+                stats->accepted++;
+        } else if (stats && w[k] >= WEIGHT_TH) {
+            stats->rejected++;
+        }
+    }
+}
+
+
+/**
+ * Accumulators of the average method, each one of roi_ny * roi_nx elements. They
+ * must start zeroed.
+ */
+struct avg_accumulator {
+    float *u, *v, *wgt, *d;
+};
+
+
+inline void avg_select(
+    const float d, const float u, const float v, const float w,
+    const std::ptrdiff_t p, const avg_accumulator &acc, uint8_t *disocclusion_mask, inversion_stats *stats
+) {
+    if (d >= WEIGHT_TH) {
+        if (std::fabs(d - acc.d[p]) <= MOTION_TH) {
+            acc.u[p] += u * w;
+            acc.v[p] += v * w;
+            acc.wgt[p] += w;
+            disocclusion_mask[p] = 0;
+        } else if (d >= acc.d[p]) {
+            //if it is an occlusion we retain the highest value
+            acc.d[p] = d;
+            acc.u[p] = u * w;
+            acc.v[p] = v * w;
+            acc.wgt[p] = w;
+            disocclusion_mask[p] = 0;
+        } else {
+            if (stats)
+                stats->rejected++;
+            return;
+        }
+        if (stats)
+            stats->accepted++;
+    }
+}
+
+
+/**
+ * Splat the motion (u, v) of the source pixel (x, y) into the average accumulators.
+ */
+inline void avg_splat(
+    const std::ptrdiff_t y, const std::ptrdiff_t x, float u, float v,
+    const avg_accumulator &acc, uint8_t *disocclusion_mask, const target_grid &grid, inversion_stats *stats = nullptr
+) {
+    const splat_footprint f(grid.map_x(float(x) + u), grid.map_y(float(y) + v), grid.ny, grid.nx);
+    // motion measured in target pixels
+    u *= grid.sx;
+    v *= grid.sy;
+    const float d = squared_norm(u, v);
+    if (stats)
+        stats->sources++;
+    // select motion
+    if (grid.inside(f.yi, f.xi)) avg_select(d, u, v, f.w1, grid.index(f.yi, f.xi), acc, disocclusion_mask, stats);
+    if (grid.inside(f.yi, f.dx)) avg_select(d, u, v, f.w2, grid.index(f.yi, f.dx), acc, disocclusion_mask, stats);
+    if (grid.inside(f.dy, f.xi)) avg_select(d, u, v, f.w3, grid.index(f.dy, f.xi), acc, disocclusion_mask, stats);
+    if (grid.inside(f.dy, f.dx)) avg_select(d, u, v, f.w4, grid.index(f.dy, f.dx), acc, disocclusion_mask, stats);
+}
+
+
+/**
+ * Turn the average accumulators into the inverse flow of the non disoccluded pixels.
+ */
+inline void avg_normalize(
+    const avg_accumulator &acc, float *flow_i, const uint8_t *disocclusion_mask, const std::ptrdiff_t size,
+    inversion_stats *stats = nullptr
+) {
+    const auto start = stats ? now_ns() : 0;
+    for (std::ptrdiff_t p = 0; p < size; p++) {
+        if (disocclusion_mask[p] == 0) {
+            flow_i[p] = -acc.u[p] / acc.wgt[p];
+            flow_i[size + p] = -acc.v[p] / acc.wgt[p];
+        }
+    }
+    if (stats) {
+        stats->normalize_ns += now_ns() - start;
+        stats->averaged += size - std::count(disocclusion_mask, disocclusion_mask + size, uint8_t(1));
+    }
+}
+
+
+/**
+ * Box [y0, y1) x [x0, x1) of the target grid.
+ */
+struct target_box {
+    std::ptrdiff_t y0, x0, y1, x1;
+
+    std::ptrdiff_t size() const { return (y1 - y0) * (x1 - x0); }
+    bool overlaps(const target_box &b) const { return y0 < b.y1 && b.y0 < y1 && x0 < b.x1 && b.x0 < x1; }
+};
+
+
+/**
+ * Bounding box, on the target grid, of the footprints of the SPLAT_TILE x SPLAT_TILE
+ * source tile (ty, tx).
+ */
+inline target_box tile_footprint(
+    const flow_view &flow, const target_grid &grid, const std::ptrdiff_t ty, const std::ptrdiff_t tx
+) {
+    const auto y_end = std::min(flow.ny, (ty + 1) * SPLAT_TILE);
+    const auto x_end = std::min(flow.nx, (tx + 1) * SPLAT_TILE);
+    float yw_min = INFINITY, xw_min = INFINITY, yw_max = -INFINITY, xw_max = -INFINITY;
+    for (std::ptrdiff_t y = ty * SPLAT_TILE; y < y_end; y++) {
+        for (std::ptrdiff_t x = tx * SPLAT_TILE; x < x_end; x++) {
+            const float yw = float(y) + flow.v(y, x);
+            const float xw = float(x) + flow.u(y, x);
+            yw_min = std::min(yw_min, yw);
+            yw_max = std::max(yw_max, yw);
+            xw_min = std::min(xw_min, xw);
+            xw_max = std::max(xw_max, xw);
+        }
+    }
+    // the corners are the integer part of the warped position and its neighbours
+    target_box box;
+    box.y0 = std::max(std::ptrdiff_t(0), std::ptrdiff_t(grid.map_y(yw_min)) - 1);
+    box.x0 = std::max(std::ptrdiff_t(0), std::ptrdiff_t(grid.map_x(xw_min)) - 1);
+    box.y1 = std::min(grid.ny, std::ptrdiff_t(grid.map_y(yw_max)) + 2);
+    box.x1 = std::min(grid.nx, std::ptrdiff_t(grid.map_x(xw_max)) + 2);
+    // positions warped outside the grid are clamped to its border
+    box.y0 = std::min(box.y0, grid.ny - 1);
+    box.x0 = std::min(box.x0, grid.nx - 1);
+    box.y1 = std::max(box.y1, std::ptrdiff_t(1));
+    box.x1 = std::max(box.x1, std::ptrdiff_t(1));
+    return box;
+}
+
+
+/**
+ * Footprints of all the source tiles, in raster order of the tiles.
+ */
+inline std::vector<target_box> tile_footprints(const flow_view &flow, const target_grid &grid) {
+    const auto tiles_y = (flow.ny + SPLAT_TILE - 1) / SPLAT_TILE;
+    const auto tiles_x = (flow.nx + SPLAT_TILE - 1) / SPLAT_TILE;
+    std::vector<target_box> footprints;
+    footprints.reserve(tiles_y * tiles_x);
+    for (std::ptrdiff_t ty = 0; ty < tiles_y; ty++)
+        for (std::ptrdiff_t tx = 0; tx < tiles_x; tx++)
+            footprints.push_back(tile_footprint(flow, grid, ty, tx));
+    return footprints;
+}
+
+
+/**
+ * Call splat(y, x, u, v) for every source pixel, in raster order. When only a region
+ * of interest is estimated, the source tiles that cannot reach it are skipped; their
+ * footprints are computed unless given.
+ */
+template <typename Splat>
+inline void splat_sources(
+    const flow_view &flow, const target_grid &grid, Splat splat, const target_box *footprints = nullptr
+) {
+    if (!grid.cropped()) {
+        for (std::ptrdiff_t y = 0; y < flow.ny; y++)
+            for (std::ptrdiff_t x = 0; x < flow.nx; x++)
+                splat(y, x, flow.u(y, x), flow.v(y, x));
+        return;
+    }
+
+    const auto tiles_y = (flow.ny + SPLAT_TILE - 1) / SPLAT_TILE;
+    const auto tiles_x = (flow.nx + SPLAT_TILE - 1) / SPLAT_TILE;
+    const target_box roi = {grid.y0, grid.x0, grid.y1, grid.x1};
+    std::vector<uint8_t> active(tiles_y * tiles_x);
+    for (std::ptrdiff_t ty = 0; ty < tiles_y; ty++) {
+        for (std::ptrdiff_t tx = 0; tx < tiles_x; tx++) {
+            const auto t = ty * tiles_x + tx;
+            active[t] = (footprints ? footprints[t] : tile_footprint(flow, grid, ty, tx)).overlaps(roi);
+        }
+    }
+
+    // the active tiles are walked row by row to keep the raster order of the splats
+    for (std::ptrdiff_t y = 0; y < flow.ny; y++) {
+        const uint8_t *active_row = &active[(y / SPLAT_TILE) * tiles_x];
+        for (std::ptrdiff_t tx = 0; tx < tiles_x; tx++) {
+            if (!active_row[tx])
+                continue;
+            const auto x_end = std::min(flow.nx, (tx + 1) * SPLAT_TILE);
+            for (std::ptrdiff_t x = tx * SPLAT_TILE; x < x_end; x++)
+                splat(y, x, flow.u(y, x), flow.v(y, x));
+        }
+    }
+}
+
+
+/**
+ * Estimate the inverse flow on the target grid keeping the largest motion. flow_i
+ * must be zeroed and the mask set to 1.
+ */
+inline void max_inverse(
+    const flow_view &flow, const target_grid &grid, float *flow_i, uint8_t *disocclusion_mask,
+    const target_box *footprints = nullptr, inversion_stats *stats = nullptr
+) {
+    const auto start = stats ? now_ns() : 0;
+    splat_sources(flow, grid, [&](std::ptrdiff_t y, std::ptrdiff_t x, float u, float v) {
+        max_splat(y, x, u, v, flow_i, disocclusion_mask, grid, stats);
+    }, footprints);
+    if (stats)
+        stats->splat_ns += now_ns() - start;
+    count_disoccluded(disocclusion_mask, grid.roi_size(), stats);
+}
+
+
+/**
+ * Estimate the inverse flow on the target grid averaging the closest motions.
+ * flow_i must be zeroed and the mask set to 1.
+ */
+inline void avg_inverse(
+    const flow_view &flow, const target_grid &grid, float *flow_i, uint8_t *disocclusion_mask,
+    const target_box *footprints = nullptr, inversion_stats *stats = nullptr
+) {
+    const auto size = grid.roi_size();
+    auto start = stats ? now_ns() : 0;
+    std::vector<float> buffer(4 * size, 0.f);
+    const avg_accumulator acc = {&buffer[0], &buffer[size], &buffer[2 * size], &buffer[3 * size]};
+    if (stats) {
+        stats->init_ns += now_ns() - start;
+        start = now_ns();
+    }
+
+    splat_sources(flow, grid, [&](std::ptrdiff_t y, std::ptrdiff_t x, float u, float v) {
+        avg_splat(y, x, u, v, acc, disocclusion_mask, grid, stats);
+    }, footprints);
+    if (stats)
+        stats->splat_ns += now_ns() - start;
+
+    avg_normalize(acc, flow_i, disocclusion_mask, size, stats);
+    count_disoccluded(disocclusion_mask, size, stats);
+}
+
+
+/**
+ * Check if the source tile (ty, tx) differs between two flows. Contiguous rows are
+ * compared with memcmp, which is vectorized by the C library.
+ */
+inline bool tile_changed(const flow_view &a, const flow_view &b, const std::ptrdiff_t ty, const std::ptrdiff_t tx) {
+    const auto y_end = std::min(a.ny, (ty + 1) * SPLAT_TILE);
+    const auto x_begin = tx * SPLAT_TILE;
+    const auto x_end = std::min(a.nx, x_begin + SPLAT_TILE);
+    const auto n = std::size_t(x_end - x_begin) * sizeof(float);
+    for (std::ptrdiff_t y = ty * SPLAT_TILE; y < y_end; y++) {
+        if (a.sx == 1 && b.sx == 1) {
+            const float *ua = &a.data[y * a.sy + x_begin], *ub = &b.data[y * b.sy + x_begin];
+            if (std::memcmp(ua, ub, n) != 0 || std::memcmp(ua + a.sc, ub + b.sc, n) != 0)
+                return true;
+        } else {
+            bool changed = false;
+            for (std::ptrdiff_t x = x_begin; x < x_end; x++)
+                changed |= (a.u(y, x) != b.u(y, x)) | (a.v(y, x) != b.v(y, x));
+            if (changed)
+                return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Regions of the target grid that may change from the inverse of the previous flow
+ * to the inverse of the new one: the old and new footprints of the changed source
+ * tiles, merged into disjoint boxes.
+ */
+inline std::vector<target_box> changed_regions(const flow_view &previous, const flow_view &flow, const target_grid &grid) {
+    const auto tiles_y = (flow.ny + SPLAT_TILE - 1) / SPLAT_TILE;
+    const auto tiles_x = (flow.nx + SPLAT_TILE - 1) / SPLAT_TILE;
+    std::vector<target_box> regions;
+    for (std::ptrdiff_t ty = 0; ty < tiles_y; ty++) {
+        for (std::ptrdiff_t tx = 0; tx < tiles_x; tx++) {
+            if (tile_changed(previous, flow, ty, tx)) {
+                regions.push_back(tile_footprint(previous, grid, ty, tx));
+                regions.push_back(tile_footprint(flow, grid, ty, tx));
+            }
+        }
+    }
+
+    // merge the overlapping boxes until all of them are disjoint
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (std::size_t i = 0; i < regions.size(); i++) {
+            for (std::size_t j = i + 1; j < regions.size(); j++) {
+                if (regions[i].overlaps(regions[j])) {
+                    regions[i].y0 = std::min(regions[i].y0, regions[j].y0);
+                    regions[i].x0 = std::min(regions[i].x0, regions[j].x0);
+                    regions[i].y1 = std::max(regions[i].y1, regions[j].y1);
+                    regions[i].x1 = std::max(regions[i].x1, regions[j].x1);
+                    regions[j] = regions.back();
+                    regions.pop_back();
+                    merged = true;
+                    j = i;
+                }
+            }
+        }
+    }
+    return regions;
+}
+
+
+/**
+ * Update in place the inverse flow of the previous flow, on the whole target grid,
+ * into the inverse flow of the new one. Only the regions reached by the changed
+ * source tiles are estimated again, with the same values as a full estimation.
+ * Returns the number of target pixels estimated again.
+ */
+inline std::ptrdiff_t update_inverse(
+    const flow_view &previous, const flow_view &flow, const target_grid &grid, const bool average,
+    float *flow_i, uint8_t *disocclusion_mask, inversion_stats *stats = nullptr
+) {
+    const auto regions = changed_regions(previous, flow, grid);
+    if (regions.empty())
+        return 0;
+
+    const auto footprints = tile_footprints(flow, grid);
+    const auto size = grid.ny * grid.nx;
+    std::ptrdiff_t updated = 0;
+    for (const auto &region : regions) {
+        auto sub_grid = grid;
+        sub_grid.y0 = region.y0;
+        sub_grid.x0 = region.x0;
+        sub_grid.y1 = region.y1;
+        sub_grid.x1 = region.x1;
+        const auto sub_size = sub_grid.roi_size();
+        const auto sub_nx = sub_grid.roi_nx();
+        std::vector<float> sub_flow(2 * sub_size, 0.f);
+        std::vector<uint8_t> sub_mask(sub_size, 1);
+        if (average)
+            avg_inverse(flow, sub_grid, sub_flow.data(), sub_mask.data(), footprints.data(), stats);
+        else
+            max_inverse(flow, sub_grid, sub_flow.data(), sub_mask.data(), footprints.data(), stats);
+
+        for (std::ptrdiff_t y = region.y0; y < region.y1; y++) {
+            const auto p = y * grid.nx + region.x0;
+            const auto q = (y - region.y0) * sub_nx;
+            std::copy(&sub_flow[q], &sub_flow[q] + sub_nx, flow_i + p);
+            std::copy(&sub_flow[sub_size + q], &sub_flow[sub_size + q] + sub_nx, flow_i + size + p);
+            std::copy(&sub_mask[q], &sub_mask[q] + sub_nx, disocclusion_mask + p);
+        }
+        updated += sub_size;
+    }
+    return updated;
+}
+
+
+/**
+ * Sample the flow at the real position (xw, yw) with bilinear interpolation,
+ * replicating the border.
+ */
+inline void bilinear_flow(const flow_view &flow, float xw, float yw, float &u, float &v) {
+    xw = std::max(0.f, std::min(float(flow.nx - 1), xw));
+    yw = std::max(0.f, std::min(float(flow.ny - 1), yw));
+    const auto x0 = std::ptrdiff_t(xw);
+    const auto y0 = std::ptrdiff_t(yw);
+    const auto x1 = std::min(flow.nx - 1, x0 + 1);
+    const auto y1 = std::min(flow.ny - 1, y0 + 1);
+    const float ex = xw - float(x0);
+    const float ey = yw - float(y0);
+    const float w00 = (1.f - ex) * (1.f - ey);
+    const float w01 = ex * (1.f - ey);
+    const float w10 = (1.f - ex) * ey;
+    const float w11 = ex * ey;
+    u = w00 * flow.u(y0, x0) + w01 * flow.u(y0, x1) + w10 * flow.u(y1, x0) + w11 * flow.u(y1, x1);
+    v = w00 * flow.v(y0, x0) + w01 * flow.v(y0, x1) + w10 * flow.v(y1, x0) + w11 * flow.v(y1, x1);
+}
+
+
+/**
+ * Compose the rows [y_begin, y_end) of the chain of n flows: every pixel follows the
+ * first flow and then gathers the next ones at the position it has reached. The
+ * result is written to the planar strip (u, v) of (y_end - y_begin) * nx elements.
+ */
+inline void compose_rows(
+    const flow_view *flows, const std::size_t n, const std::ptrdiff_t y_begin, const std::ptrdiff_t y_end,
+    float *u, float *v
+) {
+    const auto nx = flows[0].nx;
+    for (std::ptrdiff_t y = y_begin; y < y_end; y++) {
+        for (std::ptrdiff_t x = 0; x < nx; x++) {
+            float cu = flows[0].u(y, x);
+            float cv = flows[0].v(y, x);
+            for (std::size_t k = 1; k < n; k++) {
+                float ku, kv;
+                bilinear_flow(flows[k], float(x) + cu, float(y) + cv, ku, kv);
+                cu += ku;
+                cv += kv;
+            }
+            const auto p = (y - y_begin) * nx + x;
+            u[p] = cu;
+            v[p] = cv;
+        }
+    }
+}
+
+
+/**
+ * Compose the chain of n flows into the planar (2, ny, nx) buffer flow_c.
+ */
+inline void compose_flows(const flow_view *flows, const std::size_t n, float *flow_c) {
+    const auto size = flows[0].ny * flows[0].nx;
+    compose_rows(flows, n, 0, flows[0].ny, flow_c, flow_c + size);
+}
+
+
+/**
+ * Estimate the inverse of the composition of n flows without materializing it:
+ * the composed field is computed by strips of rows which are splatted right away,
+ * in the same order as max_inverse or avg_inverse would do. flow_i must be zeroed
+ * and the mask set to 1.
+ */
+inline void compose_inverse(
+    const flow_view *flows, const std::size_t n, const bool average, float *flow_i, uint8_t *disocclusion_mask,
+    inversion_stats *stats = nullptr
+) {
+    const auto ny = flows[0].ny;
+    const auto nx = flows[0].nx;
+    const auto size = ny * nx;
+    const target_grid grid(ny, nx);
+    const std::ptrdiff_t strip = COMPOSE_STRIP_ROWS * nx;
+    std::vector<float> strip_uv(2 * strip);
+    std::vector<float> buffer(average ? 4 * size : 0, 0.f);
+    avg_accumulator acc = {nullptr, nullptr, nullptr, nullptr};
+    if (average)
+        acc = {&buffer[0], &buffer[size], &buffer[2 * size], &buffer[3 * size]};
+
+    // the composition is accounted as part of the splatting
+    const auto start = stats ? now_ns() : 0;
+    for (std::ptrdiff_t y_begin = 0; y_begin < ny; y_begin += COMPOSE_STRIP_ROWS) {
+        const auto y_end = std::min(ny, y_begin + COMPOSE_STRIP_ROWS);
+        const float *u = &strip_uv[0];
+        const float *v = &strip_uv[strip];
+        compose_rows(flows, n, y_begin, y_end, &strip_uv[0], &strip_uv[strip]);
+
+        for (std::ptrdiff_t y = y_begin; y < y_end; y++) {
+            for (std::ptrdiff_t x = 0; x < nx; x++) {
+                const auto p = (y - y_begin) * nx + x;
+                if (average)
+                    avg_splat(y, x, u[p], v[p], acc, disocclusion_mask, grid, stats);
+                else
+                    max_splat(y, x, u[p], v[p], flow_i, disocclusion_mask, grid, stats);
+            }
+        }
+    }
+    if (stats)
+        stats->splat_ns += now_ns() - start;
+
+    if (average)
+        avg_normalize(acc, flow_i, disocclusion_mask, size, stats);
+    count_disoccluded(disocclusion_mask, size, stats);
+}
+
+#endif
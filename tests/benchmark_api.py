@@ -0,0 +1,148 @@
+"""End to end benchmarks of the public Python API.
+
+Calls are timed from Python, so the binding overhead, the allocation of the
+output arrays and their initialization are included. Results are compared
+with a JSON baseline and the run fails when a throughput regresses past the
+tolerance.
+
+    python tests/benchmark_api.py --save          # store the baseline
+    python tests/benchmark_api.py                 # compare with it
+    python tests/benchmark_api.py --tolerance 0.1 --sizes 480p 1080p 4K
+"""
+import argparse
+import json
+import platform
+import statistics
+import sys
+import time
+from pathlib import Path
+
+import numpy as np
+import inverse_optical_flow
+
+SIZES = {
+    "480p": (480, 854),
+    "1080p": (1080, 1920),
+    "4K": (2160, 3840),
+    "8K": (4320, 7680),
+}
+DEFAULT_BASELINE = Path(__file__).with_name("benchmark_baseline.json")
+
+
+def synthetic_flow(ny, nx, seed=0):
+    """Smooth rotation with some noise, the shape is (2, ny, nx)."""
+    rng = np.random.default_rng(seed)
+    y, x = np.mgrid[0:ny, 0:nx].astype(np.float32)
+    angle = np.deg2rad(2)
+    cy, cx = (ny - 1) / 2, (nx - 1) / 2
+    u = np.cos(angle) * (x - cx) - np.sin(angle) * (y - cy) + cx - x
+    v = np.sin(angle) * (x - cx) + np.cos(angle) * (y - cy) + cy - y
+    flow = np.stack([u, v]) + rng.uniform(-0.5, 0.5, size=(2, ny, nx))
+    return flow.astype(np.float32)
+
+
+def cases(ny, nx):
+    """Benchmarked calls, as name and function without arguments."""
+    flow = synthetic_flow(ny, nx)
+    next_flow = flow.copy()
+    next_flow[:, ny // 2:ny // 2 + 32, nx // 2:nx // 2 + 32] += 2
+    flows = [flow, synthetic_flow(ny, nx, seed=1)]
+    roi = (nx // 2, ny // 2, min(nx, nx // 2 + 256), min(ny, ny // 2 + 256))
+    backward_flow, disocclusion_mask = inverse_optical_flow.max_method(flow)
+
+    def update():
+        inverse_optical_flow.max_method_update(flow, next_flow, backward_flow, disocclusion_mask)
+        inverse_optical_flow.max_method_update(next_flow, flow, backward_flow, disocclusion_mask)
+
+    return {
+        "max_method": lambda: inverse_optical_flow.max_method(flow),
+        "avg_method": lambda: inverse_optical_flow.avg_method(flow),
+        "max_method_quarter": lambda: inverse_optical_flow.max_method(flow, scale=0.25),
+        "max_method_roi": lambda: inverse_optical_flow.max_method(flow, roi=roi),
+        "max_method_update": update,
+        "compose": lambda: inverse_optical_flow.compose(flows),
+        "compose_max": lambda: inverse_optical_flow.compose(flows, method="max"),
+    }
+
+
+def measure(function, repeat, warmup):
+    for _ in range(warmup):
+        function()
+    times = []
+    for _ in range(repeat):
+        start = time.perf_counter()
+        function()
+        times.append(time.perf_counter() - start)
+    return times
+
+
+def run(sizes, repeat, warmup):
+    results = {}
+    for size in sizes:
+        ny, nx = SIZES[size]
+        for name, function in cases(ny, nx).items():
+            times = measure(function, repeat, warmup)
+            median = statistics.median(times)
+            results[f"{name}/{size}"] = {
+                "median_s": median,
+                "min_s": min(times),
+                "pixels_per_second": ny * nx / median,
+            }
+            print(f"{name + '/' + size:32s} {median * 1e3:10.3f} ms {ny * nx / median / 1e6:10.1f} Mpx/s")
+    return results
+
+
+def compare(results, baseline, tolerance):
+    """Names of the benchmarks whose throughput regressed past the tolerance."""
+    regressions = []
+    for name, result in results.items():
+        if name not in baseline["results"]:
+            continue
+        expected = baseline["results"][name]["pixels_per_second"]
+        ratio = result["pixels_per_second"] / expected
+        status = "REGRESSION" if ratio < 1 - tolerance else "ok"
+        print(f"{name:32s} {ratio:8.3f}x baseline {status}")
+        if ratio < 1 - tolerance:
+            regressions.append(name)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--baseline", type=Path, default=DEFAULT_BASELINE, help="JSON baseline file")
+    parser.add_argument("--save", action="store_true", help="store the results as the new baseline")
+    parser.add_argument("--tolerance", type=float, default=0.15, help="allowed relative throughput loss")
+    parser.add_argument("--sizes", nargs="+", default=["480p", "1080p"], choices=list(SIZES))
+    parser.add_argument("--repeat", type=int, default=20)
+    parser.add_argument("--warmup", type=int, default=3)
+    args = parser.parse_args()
+
+    results = run(args.sizes, args.repeat, args.warmup)
+
+    if args.save:
+        baseline = {
+            "version": inverse_optical_flow.__version__,
+            "numpy": np.__version__,
+            "python": platform.python_version(),
+            "machine": platform.platform(),
+            "results": results,
+        }
+        args.baseline.write_text(json.dumps(baseline, indent=2, sort_keys=True) + "\n")
+        print(f"Baseline saved to {args.baseline}")
+        return 0
+
+    if not args.baseline.exists():
+        print(f"No baseline at {args.baseline}, run with --save to create it")
+        return 0
+
+    baseline = json.loads(args.baseline.read_text())
+    print(f"Comparing with version {baseline['version']} on {baseline['machine']}")
+    regressions = compare(results, baseline, args.tolerance)
+    if regressions:
+        print(f"{len(regressions)} benchmarks regressed more than {args.tolerance:.0%}: {', '.join(regressions)}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,35 @@
+import numpy as np
+import inverse_optical_flow
+
+# Shape of the flow is (2, height, width).
+# The first channel is horizontal, x-axis flow. The second channel is vertical, y-axis flow.
+forward_flow = np.array([
+    [[0, 0, 0],
+     [0, 1, 0],
+     [0, 0, 0]],
+
+    [[0, 2, 0],
+     [0, 1, 0],
+     [0, 0, 0]],
+], dtype=np.float32)
+
+# Composing a single flow gives the same flow
+assert np.allclose(inverse_optical_flow.compose([forward_flow]), forward_flow)
+
+# Composing two translations gives their sum
+ny, nx = 8, 10
+translation_1 = np.stack([np.full((ny, nx), 1.0), np.full((ny, nx), 2.0)]).astype(np.float32)
+translation_2 = np.stack([np.full((ny, nx), 0.5), np.full((ny, nx), -1.0)]).astype(np.float32)
+composed_flow = inverse_optical_flow.compose([translation_1, translation_2])
+assert np.allclose(composed_flow[0], 1.5), composed_flow
+assert np.allclose(composed_flow[1], 1.0), composed_flow
+
+# The inverse of the composition is the inverse of the composed flow
+rng = np.random.default_rng(0)
+flows = [rng.uniform(-3, 3, size=(2, 32, 40)).astype(np.float32) for _ in range(3)]
+composed_flow = inverse_optical_flow.compose(flows)
+for method in ("max", "avg"):
+    backward_flow, disocclusion_mask = inverse_optical_flow.compose(flows, method=method)
+    expected_flow, expected_mask = getattr(inverse_optical_flow, method + "_method")(composed_flow)
+    assert np.allclose(backward_flow, expected_flow, equal_nan=True), backward_flow
+    assert np.array_equal(disocclusion_mask, expected_mask), disocclusion_mask
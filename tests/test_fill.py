@@ -0,0 +1,95 @@
+import numpy as np
+import inverse_optical_flow
+
+ny, nx = 40, 56
+y, x = np.mgrid[0:ny, 0:nx].astype(np.float32)
+
+# A translation disoccludes the first columns; they are filled with the motion around them
+translation = np.stack([np.full((ny, nx), 3), np.full((ny, nx), -1)]).astype(np.float32)
+fills = ("push_pull", "harmonic")
+for method in (inverse_optical_flow.max_method, inverse_optical_flow.avg_method):
+    backward_flow, disocclusion_mask = method(translation)
+    assert disocclusion_mask.any()
+    valid = disocclusion_mask == 0
+    for fill in fills:
+        filled_flow, filled_mask = method(translation, fill=fill)
+        assert np.array_equal(filled_mask, disocclusion_mask)
+        assert np.array_equal(filled_flow[:, valid], backward_flow[:, valid])
+        assert np.allclose(filled_flow[0], -3) and np.allclose(filled_flow[1], 1), (fill, filled_flow)
+
+# Holes of a smooth flow take values between the valid ones; the harmonic solver stops at a residual
+tolerances = {"push_pull": 1e-5, "harmonic": 1e-2}
+flow = np.stack([np.sin(x / 9) * 4 + 2, np.cos(y / 7) * 3]).astype(np.float32)
+for fill in fills:
+    backward_flow, disocclusion_mask = inverse_optical_flow.max_method(flow, fill=fill, roi=(4, 2, 50, 36))
+    valid = disocclusion_mask == 0
+    assert np.isfinite(backward_flow).all()
+    for c in range(2):
+        assert backward_flow[c].min() >= backward_flow[c][valid].min() - tolerances[fill], fill
+        assert backward_flow[c].max() <= backward_flow[c][valid].max() + tolerances[fill], fill
+
+# A moving block leaves a strip between the background and itself, where the harmonic fill
+# solves the Laplace equation: every hole is the average of its 4 neighbours
+block = np.zeros((2, ny, nx), np.float32)
+block[0, 10:26, 12:22] = 8
+backward_flow, disocclusion_mask = inverse_optical_flow.max_method(block, fill="harmonic")
+holes = disocclusion_mask[1:-1, 1:-1] == 1
+assert holes.sum() > 50
+for c in range(2):
+    f = backward_flow[c]
+    laplacian = (f[:-2, 1:-1] + f[2:, 1:-1] + f[1:-1, :-2] + f[1:-1, 2:]) / 4 - f[1:-1, 1:-1]
+    assert np.abs(laplacian[holes]).max() < 1e-2, laplacian[holes]
+
+# Few holes make a single level, which still sweeps until the residual is small: every source
+# lands on either end of a row, and the 16 holes between them take the ramp joining their motions
+ends = np.zeros((2, 1, 18), np.float32)
+ends[0, 0, :9] = -np.arange(9)
+ends[0, 0, 9:] = 17 - np.arange(9, 18)
+backward_flow, disocclusion_mask = inverse_optical_flow.max_method(ends, fill="harmonic")
+assert disocclusion_mask.sum() == 16
+assert np.allclose(backward_flow[0, 0], np.linspace(8, -8, 18), atol=2e-2), backward_flow
+assert np.allclose(backward_flow[1], 0)
+
+# The bounded fill clears the holes it reaches and leaves the farther ones flagged
+for method in (inverse_optical_flow.max_method, inverse_optical_flow.avg_method):
+    backward_flow, disocclusion_mask = method(translation)
+    holes = disocclusion_mask == 1
+    filled_flow, filled_mask = method(translation, fill="bounded")
+    assert not filled_mask.any()
+    assert np.allclose(filled_flow[0], -3) and np.allclose(filled_flow[1], 1), filled_flow
+    filled_flow, filled_mask = method(translation, fill="bounded", fill_distance=1)
+    near = np.zeros_like(holes)
+    padded = np.pad(~holes, 1)
+    for dy in range(3):
+        for dx in range(3):
+            near |= padded[dy:dy + ny, dx:dx + nx]
+    near &= holes
+    assert near.any() and (holes & ~near).any()
+    assert np.array_equal(filled_mask == 1, holes & ~near)
+    assert np.array_equal(filled_flow[:, ~near], backward_flow[:, ~near])
+    assert np.allclose(filled_flow[:, near], np.array([[-3], [1]]))
+
+# The fill is timed by the instrumentation
+inverse_optical_flow.enable_stats(True)
+for fill in fills:
+    inverse_optical_flow.avg_method(translation, fill=fill)
+    stats = inverse_optical_flow.stats()
+    assert stats["fill_ns"] > 0 and stats["fill_iterations"] > 0, stats
+inverse_optical_flow.avg_method(translation, fill="bounded", fill_distance=2)
+assert inverse_optical_flow.stats()["fill_iterations"] == 2
+inverse_optical_flow.enable_stats(False)
+
+# Invalid fills are rejected before the estimation, which leaves the stats of the last one
+inverse_optical_flow.enable_stats(True)
+inverse_optical_flow.max_method(translation)
+last = inverse_optical_flow.stats()
+for kwargs in ({"fill": "unknown"}, {"fill": "bounded", "fill_distance": -1}, {"fill": "bounded", "fill_budget": -1}):
+    for method in (inverse_optical_flow.max_method, inverse_optical_flow.avg_method):
+        try:
+            method(translation, **kwargs)
+        except RuntimeError:
+            pass
+        else:
+            assert False, kwargs
+        assert inverse_optical_flow.stats() == last, kwargs
+inverse_optical_flow.enable_stats(False)
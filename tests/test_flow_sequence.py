@@ -0,0 +1,52 @@
+import os
+import tempfile
+
+import numpy as np
+import inverse_optical_flow
+
+rng = np.random.default_rng(0)
+ny, nx = 24, 32
+y, x = np.mgrid[0:ny, 0:nx].astype(np.float32)
+flows = []
+for t in range(10):
+    flow = np.stack([np.sin(x / 5 + t / 3), np.cos(y / 7 - t / 4)]) * (2 + t / 10)
+    flow += rng.normal(0, 0.01, flow.shape)
+    flow[:, 3:5, 7:9] = np.nan
+    flows.append(flow.astype(np.float32))
+
+with tempfile.TemporaryDirectory() as directory:
+    path = os.path.join(directory, "flows.fseq")
+
+    # Lossless: the frames come back bit for bit, in any order
+    inverse_optical_flow.save_flow_sequence(path, iter(flows), keyframe_interval=4)
+    sequence = inverse_optical_flow.FlowSequence(path)
+    assert len(sequence) == len(flows)
+    assert sequence.shape == (ny, nx)
+    for t in (0, 1, 2, 9, 5, 6, 6, 3, -1):
+        assert np.array_equal(sequence[t], flows[t], equal_nan=True), t
+    assert len([flow for flow in sequence]) == len(flows)
+
+    # Quantized: samples are rounded to the nearest multiple of the step
+    step = 1 / 64
+    inverse_optical_flow.save_flow_sequence(path, flows, step=step)
+    sequence = inverse_optical_flow.FlowSequence(path)
+    assert sequence.step == step
+    for t in (7, 0, 8):
+        assert np.array_equal(np.isnan(sequence[t]), np.isnan(flows[t]))
+        assert np.nanmax(np.abs(sequence[t] - flows[t])) <= step / 2, t
+    assert os.path.getsize(path) < sum(flow.nbytes for flow in flows) / 3
+
+    try:
+        sequence[len(flows)]
+    except IndexError:
+        pass
+    else:
+        assert False
+
+    # Every flow of a sequence has the same shape
+    try:
+        inverse_optical_flow.save_flow_sequence(path, [flows[0], flows[0][:, :-1]])
+    except RuntimeError:
+        pass
+    else:
+        assert False
@@ -0,0 +1,39 @@
+import os
+import tempfile
+
+import numpy as np
+import inverse_optical_flow
+
+rng = np.random.default_rng(0)
+flow = rng.uniform(-3, 3, size=(2, 24, 32)).astype(np.float32)
+ny, nx = flow.shape[1:]
+interleaved = flow.transpose(1, 2, 0)
+
+with tempfile.TemporaryDirectory() as directory:
+    files = {
+        "flow.flo": b"PIEH" + np.array([nx, ny], "<i4").tobytes() + interleaved.astype("<f4").tobytes(),
+        "flow.pfm": f"PF\n{nx} {ny}\n-1.0\n".encode() + np.concatenate(
+            [flow, np.zeros((1, ny, nx), np.float32)]).transpose(1, 2, 0)[::-1].astype("<f4").tobytes(),
+    }
+    for name, data in files.items():
+        with open(os.path.join(directory, name), "wb") as f:
+            f.write(data)
+    np.save(os.path.join(directory, "interleaved.npy"), interleaved)
+    np.save(os.path.join(directory, "planar.npy"), flow)
+    np.save(os.path.join(directory, "big_endian.npy"), interleaved.astype(">f4"))
+
+    for name in ("flow.flo", "flow.pfm", "interleaved.npy", "planar.npy", "big_endian.npy"):
+        mapped = inverse_optical_flow.map_flow(os.path.join(directory, name))
+        assert mapped.shape == flow.shape, (name, mapped.shape)
+        assert np.array_equal(mapped, flow), name
+
+        # The kernels read the strided view as they read the planar flow
+        for method in (inverse_optical_flow.max_method, inverse_optical_flow.avg_method):
+            for expected, result in zip(method(flow), method(mapped)):
+                assert np.array_equal(expected, result, equal_nan=True), name
+
+    # Mapped samples are not copied, and can not be written
+    mapped = inverse_optical_flow.map_flow(os.path.join(directory, "flow.flo"))
+    assert mapped.strides == (4, 8 * nx, 8), mapped.strides
+    assert not mapped.flags.writeable
+    del mapped
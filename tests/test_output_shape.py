@@ -0,0 +1,25 @@
+import numpy as np
+import inverse_optical_flow
+
+# A translation of (4, 2) pixels, horizontal and vertical.
+ny, nx = 40, 60
+forward_flow = np.stack([np.full((ny, nx), 4.0), np.full((ny, nx), 2.0)]).astype(np.float32)
+
+for method in (inverse_optical_flow.max_method, inverse_optical_flow.avg_method):
+    full_flow, full_mask = method(forward_flow)
+
+    # The default output grid is the input grid
+    same_flow, same_mask = method(forward_flow, scale=1)
+    assert np.array_equal(same_flow, full_flow) and np.array_equal(same_mask, full_mask)
+
+    # Half resolution, the inverse flow is given in output pixels
+    backward_flow, disocclusion_mask = method(forward_flow, scale=0.5)
+    assert backward_flow.shape == (2, ny // 2, nx // 2), backward_flow.shape
+    assert disocclusion_mask.shape == (ny // 2, nx // 2), disocclusion_mask.shape
+    assert np.allclose(backward_flow[:, 10:, 10:], np.array([-2, -1]).reshape(2, 1, 1)), backward_flow
+    assert not disocclusion_mask[10:, 10:].any(), disocclusion_mask
+
+    # An explicit output shape
+    backward_flow, disocclusion_mask = method(forward_flow, shape=(10, 15))
+    assert backward_flow.shape == (2, 10, 15), backward_flow.shape
+    assert np.allclose(backward_flow[:, 5:, 5:], np.array([-1, -0.5]).reshape(2, 1, 1)), backward_flow
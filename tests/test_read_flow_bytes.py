@@ -0,0 +1,26 @@
+import numpy as np
+import inverse_optical_flow
+
+rng = np.random.default_rng(0)
+flow = rng.uniform(-3, 3, size=(2, 5, 7)).astype(np.float32)
+ny, nx = flow.shape[1:]
+
+# Middlebury .flo: tag, width, height and interleaved little endian samples
+flo = b"PIEH" + np.array([nx, ny], "<i4").tobytes() + flow.transpose(1, 2, 0).astype("<f4").tobytes()
+assert np.array_equal(inverse_optical_flow.read_flow_bytes(flo), flow)
+assert np.array_equal(inverse_optical_flow.read_flow_bytes(bytearray(flo)), flow)
+
+# PFM: three channels stored bottom-up, the sign of the scale gives the endianness
+pixels = np.concatenate([flow, np.zeros((1, ny, nx), np.float32)]).transpose(1, 2, 0)[::-1]
+for scale, dtype in ((-1.0, "<f4"), (1.0, ">f4")):
+    pfm = f"PF\n{nx} {ny}\n{scale}\n".encode() + pixels.astype(dtype).tobytes()
+    assert np.array_equal(inverse_optical_flow.read_flow_bytes(pfm), flow)
+
+# Truncated data and unknown formats are rejected
+for data in (flo[:-4], b"P6\n7 5\n255\n", b""):
+    try:
+        inverse_optical_flow.read_flow_bytes(data)
+    except RuntimeError:
+        pass
+    else:
+        assert False, data
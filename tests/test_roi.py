@@ -0,0 +1,22 @@
+import numpy as np
+import inverse_optical_flow
+
+rng = np.random.default_rng(0)
+forward_flow = rng.uniform(-8, 8, size=(2, 96, 128)).astype(np.float32)
+x0, y0, x1, y1 = 40, 20, 90, 52
+
+for method in (inverse_optical_flow.max_method, inverse_optical_flow.avg_method):
+    full_flow, full_mask = method(forward_flow)
+
+    # The region of interest holds the same values as the full estimation
+    backward_flow, disocclusion_mask = method(forward_flow, roi=(x0, y0, x1, y1))
+    assert backward_flow.shape == (2, y1 - y0, x1 - x0), backward_flow.shape
+    assert disocclusion_mask.shape == (y1 - y0, x1 - x0), disocclusion_mask.shape
+    assert np.allclose(backward_flow, full_flow[:, y0:y1, x0:x1], equal_nan=True), backward_flow
+    assert np.array_equal(disocclusion_mask, full_mask[y0:y1, x0:x1]), disocclusion_mask
+
+    # The region of interest is given on the output grid
+    half_flow, half_mask = method(forward_flow, scale=0.5)
+    backward_flow, disocclusion_mask = method(forward_flow, scale=0.5, roi=(10, 5, 30, 25))
+    assert np.allclose(backward_flow, half_flow[:, 5:25, 10:30], equal_nan=True), backward_flow
+    assert np.array_equal(disocclusion_mask, half_mask[5:25, 10:30]), disocclusion_mask
@@ -0,0 +1,31 @@
+import numpy as np
+import inverse_optical_flow
+
+forward_flow = np.array([
+    [[0, 0, 0],
+     [0, 1, 0],
+     [0, 0, 0]],
+
+    [[0, 2, 0],
+     [0, 1, 0],
+     [0, 0, 0]],
+], dtype=np.float32)
+
+inverse_optical_flow.enable_stats(True)
+
+backward_flow, disocclusion_mask = inverse_optical_flow.max_method(forward_flow)
+stats = inverse_optical_flow.stats()
+assert stats["sources"] == forward_flow[0].size, stats
+assert stats["accepted"] + stats["rejected"] > 0, stats
+assert stats["disoccluded"] == disocclusion_mask.sum(), stats
+assert stats["splat_ns"] > 0, stats
+
+backward_flow, disocclusion_mask = inverse_optical_flow.avg_method(forward_flow)
+stats = inverse_optical_flow.stats()
+assert stats["averaged"] == (disocclusion_mask == 0).sum(), stats
+assert stats["disoccluded"] == disocclusion_mask.sum(), stats
+
+# Disabled, the stats of the last instrumented call are kept
+inverse_optical_flow.enable_stats(False)
+inverse_optical_flow.max_method(forward_flow)
+assert inverse_optical_flow.stats() == stats
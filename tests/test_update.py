@@ -0,0 +1,25 @@
+import numpy as np
+import inverse_optical_flow
+
+rng = np.random.default_rng(0)
+previous_flow = rng.uniform(-3, 3, size=(2, 96, 128)).astype(np.float32)
+
+# The flow only changes in a small moving region
+flow = previous_flow.copy()
+flow[:, 40:52, 60:76] += 2
+
+for method in ("max", "avg"):
+    full_method = getattr(inverse_optical_flow, method + "_method")
+    update_method = getattr(inverse_optical_flow, method + "_method_update")
+
+    backward_flow, disocclusion_mask = full_method(previous_flow)
+
+    # Nothing changed, nothing is estimated again
+    assert update_method(previous_flow, previous_flow, backward_flow, disocclusion_mask) == 0
+
+    # The update matches the full estimation of the new flow
+    updated = update_method(previous_flow, flow, backward_flow, disocclusion_mask)
+    assert 0 < updated < disocclusion_mask.size, updated
+    expected_flow, expected_mask = full_method(flow)
+    assert np.allclose(backward_flow, expected_flow, equal_nan=True), backward_flow
+    assert np.array_equal(disocclusion_mask, expected_mask), disocclusion_mask